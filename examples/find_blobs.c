@@ -10,7 +10,7 @@ int box_filter(int width, int height)
     return !(width < 40 || height < 40 || (width >= 400 && height >= 400));
 }
 
-image detect_blobs_from_path(char* path, int num_dilations)
+image detect_blobs_from_path(char* path, int num_dilations, int use_rle)
 {
     image original = load_image_rgb(path);
     image gray = rgb_to_grayscale(original);
@@ -18,15 +18,26 @@ image detect_blobs_from_path(char* path, int num_dilations)
 
     double t1 = time_now();
     image binary = binarize_image(gray, 0);
-    image dilated = dilate_image(binary, num_dilations);
-    box* detections = detect_blobs(dilated, &num_boxes, &box_filter);
+    image dilated = make_empty_image(0, 0, 0);
+    box* detections;
+    if(use_rle) {
+        rle_image runs = make_rle_image(binary, 0.5f);
+        rle_image dilated_runs = rle_dilate(runs, num_dilations);
+        detections = detect_blobs_rle(dilated_runs, &num_boxes, &box_filter);
+        free_rle_image(&runs);
+        free_rle_image(&dilated_runs);
+    }
+    else {
+        dilated = dilate_image(binary, num_dilations);
+        detections = detect_blobs(dilated, &num_boxes, &box_filter);
+    }
     double t2 = time_now();
     printf("blob detection took %.3lf seconds\n", t2-t1);
     printf("found %d blobs\n", num_boxes);
     
     draw_blob_detections(&original, detections, num_boxes);
 
-    if(detections) free((int*)detections - 2);
+    free_blobs(detections);
     free_image(&gray);
     free_image(&binary);
     free_image(&dilated);
@@ -37,11 +48,11 @@ image detect_blobs_from_path(char* path, int num_dilations)
 void run_blob_detect(int argc,  char** argv)
 {
     if(argc < 3) {
-        fprintf(stderr, "usage: ./boomercv blobs -i <input_path> [OPTIONAL PARAMETERS: -o <output_path> -n <number_of_dilations>]\n");
+        fprintf(stderr, "usage: ./boomercv blobs -i <input_path> [OPTIONAL PARAMETERS: -o <output_path> -n <number_of_dilations> -rle <1 to work on run-length encoded masks>]\n");
         return;
     }
     char input_path[256] = {0}, output_path[512] = {0};
-    int num_dilations = 12;
+    int num_dilations = 12, use_rle = 0;
 
     for (int i = 1; i < argc; ++i) {
         if (i < argc - 1) {
@@ -54,13 +65,16 @@ void run_blob_detect(int argc,  char** argv)
             else if (strcmp("-n", argv[i]) == 0) {
                 num_dilations = atoi(argv[i+1]);
             }
+            else if (strcmp("-rle", argv[i]) == 0) {
+                use_rle = atoi(argv[i+1]);
+            }
         }
     }
     if(input_path[0] == '\0') {
         fprintf(stderr, "image path not provided, exiting program..\n");
         return;
     }
-    image detections = detect_blobs_from_path(input_path, num_dilations);
+    image detections = detect_blobs_from_path(input_path, num_dilations, use_rle);
     if (output_path[0] == '\0') {
         strcat(output_path, input_path);
 
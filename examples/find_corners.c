@@ -1,4 +1,6 @@
 #include "harris.h"
+#include "fast.h"
+#include "keypoints.h"
 #include "image.h"
 #include "utils.h"
 
@@ -6,19 +8,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-image find_corners_from_path(char* path, float sigma, float thresh, int nms)
+image find_corners_from_path(char* path, float sigma, float thresh, int nms, int fast, int shi_tomasi, int arc,
+                             int cell, int per_cell, int max_corners, int anms, int subpixel)
 {
     image original = load_image_rgb(path);
 
-    int num_descriptors;
+    int n;
+    float* score;
     double t1 = time_now();
-    descriptor* d = harris_corner_detector(original, sigma, thresh, nms, &num_descriptors);
+    point* p = fast ? fast_corners(original, thresh, arc, nms > 0, subpixel, &score, &n)
+                    : harris_corners(original, sigma, shi_tomasi ? SHI_TOMASI_RESPONSE : HARRIS_RESPONSE, thresh, nms, subpixel, &score, &n);
+    n = grid_bucket_keypoints(p, score, n, original.w, original.h, cell, per_cell);
+    n = anms ? anms_keypoints(p, score, n, max_corners, .9f) : retain_best_keypoints(p, score, n, max_corners);
     double t2 = time_now();
-    printf("found %d corners\n", num_descriptors);
+    printf("found %d corners\n", n);
     printf("corner detection took %.3lf seconds\n", t2-t1);
-    draw_corners(&original, d, num_descriptors);
 
-    free_descriptors(d, num_descriptors);
+    descriptor_set corners = describe_patches(original, p, score, n);
+    draw_corner_set(&original, corners);
+
+    free_descriptor_set(&corners);
+    free(p); free(score);
 
     return original;
 }
@@ -26,12 +36,12 @@ image find_corners_from_path(char* path, float sigma, float thresh, int nms)
 void run_corner_detection(int argc,  char** argv)
 {
     if(argc < 3) {
-        fprintf(stderr, "usage: ./boomercv corners -i <input_path> [OPTIONAL PARAMETERS: -o <output_path>]\n");
+        fprintf(stderr, "usage: ./boomercv corners -i <input_path> [OPTIONAL PARAMETERS: -o <output_path> -fast <1 for FAST corners> -shi_tomasi <1 for the smallest eigenvalue response> -arc <FAST arc length> -cell <grid cell size> -per_cell <corners per cell> -max <corner budget> -anms <1 for ANMS> -subpixel <1 for sub-pixel corners>]\n");
         return;
     }
     char input_path[256] = {0}, output_path[512] = {0};
-    float sigma = 2.f, thresh = 50.f;
-    int nms = 3;
+    float sigma = 2.f, thresh = -1.f;
+    int nms = 3, fast = 0, shi_tomasi = 0, arc = 9, cell = 0, per_cell = 0, max_corners = 0, anms = 0, subpixel = 0;
     for (int i = 1; i < argc; ++i) {
         if (i < argc - 1) {
             if (strcmp("-i", argv[i]) == 0) {
@@ -49,13 +59,38 @@ void run_corner_detection(int argc,  char** argv)
             else if (strcmp("-nms", argv[i]) == 0) {
                 nms = atoi(argv[i+1]);
             }
+            else if (strcmp("-fast", argv[i]) == 0) {
+                fast = atoi(argv[i+1]);
+            }
+            else if (strcmp("-shi_tomasi", argv[i]) == 0) {
+                shi_tomasi = atoi(argv[i+1]);
+            }
+            else if (strcmp("-arc", argv[i]) == 0) {
+                arc = atoi(argv[i+1]);
+            }
+            else if (strcmp("-cell", argv[i]) == 0) {
+                cell = atoi(argv[i+1]);
+            }
+            else if (strcmp("-per_cell", argv[i]) == 0) {
+                per_cell = atoi(argv[i+1]);
+            }
+            else if (strcmp("-max", argv[i]) == 0) {
+                max_corners = atoi(argv[i+1]);
+            }
+            else if (strcmp("-anms", argv[i]) == 0) {
+                anms = atoi(argv[i+1]);
+            }
+            else if (strcmp("-subpixel", argv[i]) == 0) {
+                subpixel = atoi(argv[i+1]);
+            }
         }
     }
     if(input_path[0] == '\0') {
         fprintf(stderr, "image path not provided, exiting program..\n");
         return;
     }
-    image corners = find_corners_from_path(input_path, sigma, thresh, nms);
+    if(thresh < 0) thresh = fast ? .08f : 50.f;
+    image corners = find_corners_from_path(input_path, sigma, thresh, nms, fast, shi_tomasi, arc, cell, per_cell, max_corners, anms, subpixel);
     if (output_path[0] == '\0') {
         strcat(output_path, input_path);
 
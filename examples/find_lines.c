@@ -7,7 +7,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-image find_lines_from_path(char* path, int threshold)
+image find_lines_from_path(char* path, int threshold, int k, int probabilistic, int min_length, int max_gap, int min_radius, int max_radius)
 {
     image original = load_image_rgb(path);
     line* lines;
@@ -15,12 +15,21 @@ image find_lines_from_path(char* path, int threshold)
 
     double t1 = time_now();
     image canny = canny_image(original, 1);
-    lines = hough_line_detect(canny, threshold, &num_lines);
+    if(probabilistic) lines = hough_line_segments_detect(canny, threshold, min_length, max_gap, 0, &num_lines);
+    else lines = hough_line_detect_k(canny, threshold, k, &num_lines);
     printf("found %d lines\n", num_lines);
     draw_hough_lines(&original, lines, num_lines, 255, 0, 225);
+    if(max_radius > 0) {
+        int num_circles;
+        circle* circles = hough_circle_detect(original, canny, min_radius, max_radius, 0, &num_circles);
+        printf("found %d circles\n", num_circles);
+        draw_hough_circles(&original, circles, num_circles, 0, 255, 0);
+        free_circles(circles);
+    }
     double t2 = time_now();
     printf("line detection took %.3lf seconds\n", t2-t1);
 
+    free_lines(lines);
     free_image(&canny);
     return original;
 }
@@ -28,11 +37,11 @@ image find_lines_from_path(char* path, int threshold)
 void run_find_lines(int argc,  char** argv)
 {
     if(argc < 3) {
-        fprintf(stderr, "usage: ./boomercv lines -i <input_path> [OPTIONAL PARAMETERS: -o <output_path>, -t <threshold>]\n");
+        fprintf(stderr, "usage: ./boomercv lines -i <input_path> [OPTIONAL PARAMETERS: -o <output_path>, -t <threshold>, -k <keep k strongest lines>, -p <1 for line segments>, -min_length <min segment length>, -max_gap <max gap in segment>, -min_radius <min circle radius>, -max_radius <max circle radius, enables circles>]\n");
         return;
     }
     char input_path[256] = {0}, output_path[512] = {0};
-    int threshold = 0;
+    int threshold = 0, k = 0, probabilistic = 0, min_length = 0, max_gap = 5, min_radius = 5, max_radius = 0;
 
     for (int i = 1; i < argc; ++i) {
         if (i < argc - 1) {
@@ -45,13 +54,31 @@ void run_find_lines(int argc,  char** argv)
             else if (strcmp("-t", argv[i]) == 0) {
                 threshold = atoi(argv[i+1]);
             }
+            else if (strcmp("-k", argv[i]) == 0) {
+                k = atoi(argv[i+1]);
+            }
+            else if (strcmp("-p", argv[i]) == 0) {
+                probabilistic = atoi(argv[i+1]);
+            }
+            else if (strcmp("-min_length", argv[i]) == 0) {
+                min_length = atoi(argv[i+1]);
+            }
+            else if (strcmp("-max_gap", argv[i]) == 0) {
+                max_gap = atoi(argv[i+1]);
+            }
+            else if (strcmp("-min_radius", argv[i]) == 0) {
+                min_radius = atoi(argv[i+1]);
+            }
+            else if (strcmp("-max_radius", argv[i]) == 0) {
+                max_radius = atoi(argv[i+1]);
+            }
         }
     }
     if(input_path[0] == '\0') {
         fprintf(stderr, "image path not provided, exiting program..\n");
         return;
     }
-    image hough_img = find_lines_from_path(input_path, threshold);
+    image hough_img = find_lines_from_path(input_path, threshold, k, probabilistic, min_length, max_gap, min_radius, max_radius);
     if (output_path[0] == '\0') {
         strcat(output_path, input_path);
 
@@ -5,82 +5,156 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 
-image panorama_from_paths(char* path1, char* path2, float sigma, float thresh, float inlier_thresh,
-                              int nms_window_size, int cutoff, int num_iters, int debug, int f1, int f2)
+static image* load_panorama_images(char** paths, int n, const int* focal)
 {
-    srand(time(0));
-    image im1 = load_image_rgb(path1);
-    image im2 = load_image_rgb(path2);
-
-    if(f1 > 0) {
-        printf("performing cylindrical projection on %s with focal length %d\n", path1, f1);
-        image cyl1 = cylindrical_project(im1, f1);
-        free_image(&im1);
-        im1 = cyl1;
-    }
-    if(f2 > 0) {
-        printf("performing cylindrical projection on %s with focal length %d\n", path2, f2);
-        image cyl2 = cylindrical_project(im2, f2);
-        free_image(&im2);
-        im2 = cyl2;
+    image* m = calloc(n, sizeof(image));
+    for(int i = 0; i < n; ++i) {
+        m[i] = load_image_rgb(paths[i]);
+        if(focal[i] > 0) {
+            printf("performing cylindrical projection on %s with focal length %d\n", paths[i], focal[i]);
+            image cyl = cylindrical_project(m[i], focal[i]);
+            free_image(&m[i]);
+            m[i] = cyl;
+        }
     }
+    return m;
+}
 
-    image out;
+image panorama_from_paths(char** paths, int n, panorama_options o, const int* focal)
+{
+    image* m = load_panorama_images(paths, n, focal);
     double t1 = time_now();
-    out = panorama_image(im1, im2, sigma, thresh, nms_window_size,
-                         inlier_thresh, num_iters, cutoff, debug);
+    image out = n == 2 ? panorama_image(m[0], m[1], o) : panorama_images(m, n, o);
     double t2 = time_now();
     printf("took %.3lf seconds to create panorama\n", t2-t1);
 
-    free_image(&im1);
-    free_image(&im2);
-
+    for(int i = 0; i < n; ++i) free_image(&m[i]);
+    free(m);
     return out;
 }
 
-void run_panorama(int argc, char** argv)
+// Stitches onto a tiled canvas holding about memory bytes, and streams it to filename.png.
+// int jpg: JPEG quality to save filename.jpg instead, if the 8 bit image fits in memory, 0 for PNG.
+void panorama_canvas_from_paths(char** paths, int n, panorama_options o, const int* focal, size_t memory, int jpg, const char* filename)
 {
-    if(argc < 4) {
-        fprintf(stderr, "usage: ./boomercv panorama path1 path2"\
-                " [-sigma <sigma> -thresh <threshold> -inlier_thresh <inlier threshold> -num_iters <num iterations> -cutoff <inlier cutoff> -nms_window_size <nms window size> -debug <1 if show debug image> -f1 <focal length image 1> -f2 <focal length image 2>] \n");
-        return;
-    }
-    char path1[256] = {0}, path2[256] = {0};
-
-    strcpy(path1, argv[2]);
-    strcpy(path2, argv[3]);
+    image* m = load_panorama_images(paths, n, focal);
+    double t1 = time_now();
+    canvas cv = panorama_canvas(m, n, o, memory);
+    double t2 = time_now();
+    printf("took %.3lf seconds to create %dx%d panorama\n", t2-t1, cv.w, cv.h);
+    for(int i = 0; i < n; ++i) free_image(&m[i]);
+    free(m);
+    if(jpg <= 0 || !save_canvas_jpg(&cv, filename, jpg)) save_canvas_png(&cv, filename);
+    free_canvas(&cv);
+}
 
-    if(path1[0] == '\0' || path2[0] == '\0') {
-        fprintf(stderr, "two image paths not provided, exiting program..\n");
+void run_panorama(int argc, char** argv)
+{
+    // the image paths come first, up to the first option
+    int n = 0;
+    while(2 + n < argc && argv[2 + n][0] != '-') n++;
+    if(n < 2) {
+        fprintf(stderr, "usage: ./boomercv panorama path1 path2 [path3 ...]"\
+                " [-detector <harris, shi_tomasi or fast> -descriptor <patch or binary> -sigma <sigma> -thresh <threshold> -fast_thresh <FAST threshold> -fast_arc <FAST arc length> -cell <grid cell size> -per_cell <corners per cell> -max_keypoints <corner budget> -anms <1 for ANMS> -subpixel <1 for sub-pixel corners> -levels <pyramid levels> -level_scale <pyramid scale step> -first_level <first pyramid level> -inlier_thresh <inlier threshold> -num_iters <num iterations> -cutoff <inlier cutoff> -confidence <RANSAC confidence> -prosac <0 for uniform sampling> -seed <RANSAC seed> -neighbors <images matched ahead> -min_inliers <inliers to connect images> -nms_window_size <nms window size> -debug <1 if show debug image> -coarse <downscale for coarse-to-fine registration> -search_radius <guided matching radius> -blend <none (default), feather or multiband> -bands <multiband levels> -f <focal length of all images> -f1 <focal length image 1> -f2 <focal length image 2> -memory <MB of canvas tiles in memory, for large panoramas> -jpg <JPEG quality, with -memory only if the whole 8 bit panorama fits in it, else PNG>] \n");
         return;
     }
+    char** paths = argv + 2;
 
-    float sigma=2.f, thresh=2.f, inlier_thresh=2.f;
-    int nms_window_size=3, cutoff=30, num_iters=10000, debug=0, f1=0, f2=0;
-    for (int i = 4; i < argc; ++i) {
+    panorama_options o = default_panorama_options();
+    int f = 0, f1 = 0, f2 = 0, memory = 0, jpg = 0;
+    for (int i = 2 + n; i < argc; ++i) {
         if (i < argc - 1) {
-            if (strcmp("-sigma", argv[i]) == 0) {
-                sigma = atof(argv[i+1]);
+            if (strcmp("-detector", argv[i]) == 0) {
+                if(strcmp("fast", argv[i+1]) == 0) o.detector = FAST_DETECTOR;
+                else if(strcmp("shi_tomasi", argv[i+1]) == 0) o.detector = SHI_TOMASI_DETECTOR;
+                else o.detector = HARRIS_DETECTOR;
+            }
+            else if (strcmp("-descriptor", argv[i]) == 0) {
+                o.descriptor = strcmp("binary", argv[i+1]) == 0 ? BINARY_DESCRIPTOR : FLOAT_DESCRIPTOR;
+            }
+            else if (strcmp("-sigma", argv[i]) == 0) {
+                o.sigma = atof(argv[i+1]);
             }
             else if (strcmp("-thresh", argv[i]) == 0) {
-                thresh = atof(argv[i+1]);
+                o.thresh = atof(argv[i+1]);
+            }
+            else if (strcmp("-fast_thresh", argv[i]) == 0) {
+                o.fast_thresh = atof(argv[i+1]);
+            }
+            else if (strcmp("-fast_arc", argv[i]) == 0) {
+                o.fast_arc = atoi(argv[i+1]);
+            }
+            else if (strcmp("-cell", argv[i]) == 0) {
+                o.cell = atoi(argv[i+1]);
+            }
+            else if (strcmp("-per_cell", argv[i]) == 0) {
+                o.per_cell = atoi(argv[i+1]);
+            }
+            else if (strcmp("-max_keypoints", argv[i]) == 0) {
+                o.max_keypoints = atoi(argv[i+1]);
+            }
+            else if (strcmp("-anms", argv[i]) == 0) {
+                o.anms = atoi(argv[i+1]);
+            }
+            else if (strcmp("-subpixel", argv[i]) == 0) {
+                o.subpixel = atoi(argv[i+1]);
+            }
+            else if (strcmp("-levels", argv[i]) == 0) {
+                o.levels = atoi(argv[i+1]);
+            }
+            else if (strcmp("-level_scale", argv[i]) == 0) {
+                o.level_scale = atof(argv[i+1]);
+            }
+            else if (strcmp("-first_level", argv[i]) == 0) {
+                o.first_level = atoi(argv[i+1]);
             }
             else if (strcmp("-inlier_thresh", argv[i]) == 0) {
-                inlier_thresh = atof(argv[i+1]);
+                o.inlier_thresh = atof(argv[i+1]);
             }
             else if (strcmp("-num_iters", argv[i]) == 0) {
-                num_iters = atoi(argv[i+1]);
+                o.iters = atoi(argv[i+1]);
             }
             else if (strcmp("-cutoff", argv[i]) == 0) {
-                cutoff = atoi(argv[i+1]);
+                o.cutoff = atoi(argv[i+1]);
+            }
+            else if (strcmp("-confidence", argv[i]) == 0) {
+                o.confidence = atof(argv[i+1]);
+            }
+            else if (strcmp("-prosac", argv[i]) == 0) {
+                o.prosac = atoi(argv[i+1]);
+            }
+            else if (strcmp("-seed", argv[i]) == 0) {
+                o.seed = strtoul(argv[i+1], NULL, 10);
             }
             else if (strcmp("-nms_window_size", argv[i]) == 0) {
-                nms_window_size = atoi(argv[i+1]);
+                o.nms = atoi(argv[i+1]);
             }
             else if (strcmp("-debug", argv[i]) == 0) {
-                debug = atoi(argv[i+1]);
+                o.draw_matches = atoi(argv[i+1]);
+            }
+            else if (strcmp("-neighbors", argv[i]) == 0) {
+                o.neighbors = atoi(argv[i+1]);
+            }
+            else if (strcmp("-min_inliers", argv[i]) == 0) {
+                o.min_inliers = atoi(argv[i+1]);
+            }
+            else if (strcmp("-coarse", argv[i]) == 0) {
+                o.coarse = atoi(argv[i+1]);
+            }
+            else if (strcmp("-search_radius", argv[i]) == 0) {
+                o.search_radius = atof(argv[i+1]);
+            }
+            else if (strcmp("-blend", argv[i]) == 0) {
+                if(strcmp("none", argv[i+1]) == 0) o.blend = BLEND_NONE;
+                else if(strcmp("feather", argv[i+1]) == 0) o.blend = BLEND_FEATHER;
+                else o.blend = BLEND_MULTIBAND;
+            }
+            else if (strcmp("-bands", argv[i]) == 0) {
+                o.bands = atoi(argv[i+1]);
+            }
+            else if (strcmp("-f", argv[i]) == 0) {
+                f = atoi(argv[i+1]);
             }
             else if (strcmp("-f1", argv[i]) == 0) {
                 f1 = atoi(argv[i+1]);
@@ -88,13 +162,30 @@ void run_panorama(int argc, char** argv)
             else if (strcmp("-f2", argv[i]) == 0) {
                 f2 = atoi(argv[i+1]);
             }
+            else if (strcmp("-memory", argv[i]) == 0) {
+                memory = atoi(argv[i+1]);
+            }
+            else if (strcmp("-jpg", argv[i]) == 0) {
+                jpg = atoi(argv[i+1]);
+            }
         }
     }
 
-    const char* output_path = debug ? "panorama_debug" : "panorama";
+    const char* output_path = o.draw_matches ? "panorama_debug" : "panorama";
 
-    image panorama = panorama_from_paths(path1, path2, sigma, thresh, inlier_thresh,
-                                         nms_window_size, cutoff, num_iters, debug, f1, f2);
-    save_image_png(panorama, output_path);
+    int* focal = calloc(n, sizeof(int));
+    for(int i = 0; i < n; ++i) focal[i] = f;
+    if(f1 > 0) focal[0] = f1;
+    if(f2 > 0) focal[1] = f2;
+    if(memory > 0 && o.draw_matches) fprintf(stderr, "ignoring -memory, the -debug image is built in memory\n");
+    if(memory > 0 && !o.draw_matches) {
+        panorama_canvas_from_paths(paths, n, o, focal, (size_t)memory << 20, jpg, output_path);
+        free(focal);
+        return;
+    }
+    image panorama = panorama_from_paths(paths, n, o, focal);
+    free(focal);
+    if(jpg > 0) save_image_jpg(panorama, output_path, jpg);
+    else save_image_png(panorama, output_path);
     free_image(&panorama);
 }
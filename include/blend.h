@@ -0,0 +1,36 @@
+#ifndef BLEND_H
+#define BLEND_H
+
+#include "image.h"
+#include "homography.h"
+#include "warp.h"
+#include "canvas.h"
+
+// How a warped image is combined with what is already on the destination.
+// BLEND_NONE: later images overwrite earlier ones.
+// BLEND_FEATHER: average weighted by the distance to the edges of each image.
+// BLEND_MULTIBAND: Laplacian pyramid blending, low frequencies blend over wide seams and fine detail
+//                  over narrow ones, so exposure differences fade without ghosting detail.
+typedef enum {
+    BLEND_NONE,
+    BLEND_FEATHER,
+    BLEND_MULTIBAND
+} blend_mode;
+
+// Feathering weights of a w x h image: the product of tents falling from 1 at the center
+// to 0 at the edges in x and in y.
+image feather_weights(int w, int h);
+
+// warp_perspective that blends src into dst instead of overwriting it.
+// The destination is processed in CANVAS_TILE tiles in parallel. Multiband tiles read a margin of
+// 2^(bands+1) pixels around them and build their pyramids on that window only, and only tiles
+// within the margin of pixels covered by both images build pyramids at all. Tiles are blended a row
+// at a time and held only until the rows whose margin reaches them are blended.
+// image weight: single channel, the size of dst, the weights of what is on dst, 0 where nothing is.
+//               Updated by every call, start it at 0.
+// int bands: pyramid levels of BLEND_MULTIBAND.
+void blend_warp(image src, hom3 H, image dst, image weight, rect roi, blend_mode mode, int bands);
+// blend_warp onto a canvas, with the weights on a single channel canvas of the same size
+void blend_warp_canvas(image src, hom3 H, canvas* dst, canvas* weight, rect roi, blend_mode mode, int bands);
+
+#endif
@@ -2,15 +2,40 @@
 #define BLOB_H
 
 #include "image.h"
+#include "rle.h"
 
+// Statistics of a connected component.
+// int label: value of the component in the label map, starting at 1.
+// int area: number of pixels in the component.
+// float cx, cy: centroid of the component.
+// double m10, m01: first moments, the sum of the x and y coordinates of its pixels.
 typedef struct {
     int xmin, xmax;
     int ymin, ymax;
     int label;
+    int area;
+    float cx, cy;
+    double m10, m01;
 } cc_label;
 
+// Two-pass connected component labeling of the pixels > 0 in m, labeled in parallel strips of rows.
+// int connectivity: 4 or 8.
+// image* label_map: if not NULL, gets a 1 channel image with the label of every pixel, 0 for background.
+// returns: stretchy buffer of components, ordered by their first pixel in raster order.
+cc_label* connected_components(image m, int connectivity, image* label_map);
+// connected_components with 8 connectivity, numbering the labels from 0 like it always has.
 cc_label* cc_label_image(image m);
+
+// Connected components over the runs of r instead of its pixels.
+// int** run_labels: if not NULL, gets a malloced array with the label of every run.
+cc_label* rle_connected_components(rle_image r, int connectivity, int** run_labels);
+
+// Bounding boxes of the 8 connected components that box_filter accepts, in label order.
+// The score of a box is the area of its component in pixels.
 box* detect_blobs(image m, int* num_boxes, int(*box_filter)(int width, int height));
+box* detect_blobs_rle(rle_image r, int* num_boxes, int(*box_filter)(int width, int height));
 void draw_blob_detections(image* m, box* detections, int num_detections);
+// frees the array returned by detect_blobs or detect_blobs_rle
+void free_blobs(box* detections);
 
 #endif
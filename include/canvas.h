@@ -0,0 +1,56 @@
+#ifndef CANVAS_H
+#define CANVAS_H
+
+#include "image.h"
+#include "homography.h"
+#include "warp.h"
+
+#include <stddef.h>
+
+#define CANVAS_TILE 256
+
+// A large image in CANVAS_TILE x CANVAS_TILE tiles, for panoramas that do not fit in memory as one image.
+// Tiles are allocated on first write and read as 0 before. At most budget tiles stay in memory, the least
+// recently used unpinned tile is spilled to a memory mapped scratch file, unlinked on creation,
+// when another one is needed.
+// int w, h, c: size of the image.
+// int cols, rows: number of tiles across and down.
+// size_t budget: most tiles in memory, exceeded only while more tiles than that are pinned.
+typedef struct {
+    int w, h, c;
+    int cols, rows;
+    size_t budget, resident;
+    float** tile;
+    int* pins;
+    char* spilled;
+    unsigned long* last_use;
+    unsigned long clock;
+    int fd;
+    char* scratch;
+    size_t scratch_size;
+} canvas;
+
+// size_t memory: bytes of tiles to keep in memory, at least one tile per thread is kept anyway.
+canvas make_canvas(int w, int h, int c, size_t memory);
+void free_canvas(canvas* cv);
+
+// Pins tile tx, ty in memory and returns it as a CANVAS_TILE x CANVAS_TILE image, loading or allocating it.
+// With create 0, a tile that was never written is not allocated and the image has no data.
+// Pinned tiles are never spilled, release them when done. Safe to call from several threads.
+image acquire_canvas_tile(canvas* cv, int tx, int ty, int create);
+void release_canvas_tile(canvas* cv, int tx, int ty);
+// the pixels of the canvas covered by tile tx, ty
+rect canvas_tile_rect(canvas* cv, int tx, int ty);
+
+// warp_perspective onto a canvas, one tile per thread, only touching the tiles that src reaches.
+void warp_canvas(image src, hom3 H, canvas* cv, rect roi);
+
+// Writes the canvas to filename.png a band of tiles at a time. Each band is filtered and deflated
+// into the one zlib stream as it is read, so nothing but the band is held.
+int save_canvas_png(canvas* cv, const char* filename);
+// Writes filename.jpg. The JPEG encoder needs the whole image, so this converts the canvas to one
+// 8 bit image first, a quarter of the memory of a float image. Fails if that image is larger than
+// the memory of the canvas, or the canvas larger than the 65535 pixels a side of JPEG.
+int save_canvas_jpg(canvas* cv, const char* filename, int quality);
+
+#endif
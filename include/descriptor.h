@@ -0,0 +1,110 @@
+#ifndef DESCRIPTOR_H
+#define DESCRIPTOR_H
+
+#include "image.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    FLOAT_DESCRIPTOR,
+    BINARY_DESCRIPTOR // bit strings compared by hamming distance
+} descriptor_type;
+
+// A set of descriptors stored as one contiguous n x stride matrix, with the keypoints in parallel arrays.
+// descriptor_type type: float descriptors live in data, binary ones in bits.
+// int n: the number of descriptors.
+// int d: the number of floating point values, or bits, in each descriptor.
+// int stride: floats from one descriptor to the next, d rounded up to a multiple of 8 and zero padded.
+//             For binary descriptors the number of 64 bit words per descriptor.
+// point* p: x,y coordinates of the keypoint of every descriptor, in full resolution pixels.
+// float* score: detector response of every keypoint.
+// int* level: pyramid level every keypoint was found and described on, 0 for full resolution.
+// float* data: n*stride floats, 32 byte aligned. NULL for binary descriptors.
+// uint64_t* bits: n*stride words, 32 byte aligned. NULL for float descriptors.
+typedef struct {
+    descriptor_type type;
+    int n, d, stride;
+    point* p;
+    float* score;
+    int* level;
+    float* data;
+    uint64_t* bits;
+} descriptor_set;
+
+// Distance between two float descriptors. Binary descriptors always use the hamming distance.
+// DISTANCE_L1: sum of absolute differences.
+// DISTANCE_L2: euclidean distance.
+typedef enum {
+    DISTANCE_L1,
+    DISTANCE_L2
+} distance_metric;
+
+// The two nearest descriptors in a set to a query descriptor, for matching and ratio tests.
+// int best, second: indexes of the nearest and the second nearest descriptor, -1 if there is none.
+// float best_dist, second_dist: their distances to the query, FLT_MAX if there is none.
+typedef struct {
+    int best, second;
+    float best_dist, second_dist;
+} nearest_pair;
+
+// Ratio test: keeps a nearest neighbour only if it is distinctly closer than the second nearest.
+// float ratio: threshold on best_dist/second_dist, 1 or more keeps every neighbour.
+static inline int ratio_test(nearest_pair nn, float ratio)
+{
+    if(nn.best < 0) return 0;
+    return ratio >= 1.f || nn.second < 0 || nn.best_dist < ratio*nn.second_dist;
+}
+
+descriptor_set make_descriptor_set(int n, int d);
+descriptor_set make_binary_descriptor_set(int n, int bits);
+void free_descriptor_set(descriptor_set* s);
+// one set with the descriptors of all n sets in order. The sets must have the same type and size.
+descriptor_set concat_descriptor_sets(const descriptor_set* s, int n);
+
+static inline float* descriptor_row(descriptor_set s, int i)
+{
+    return s.data + (size_t)i*s.stride;
+}
+
+static inline uint64_t* descriptor_bits(descriptor_set s, int i)
+{
+    return s.bits + (size_t)i*s.stride;
+}
+
+static inline int popcount64(uint64_t x)
+{
+#if defined(__x86_64__) && !defined(__POPCNT__)
+    // without the popcnt instruction the builtin is a library call, count bits in parallel instead
+    x = x - ((x >> 1) & 0x5555555555555555ull);
+    x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return (x*0x0101010101010101ull) >> 56;
+#else
+    return __builtin_popcountll(x);
+#endif
+}
+
+// number of differing bits
+static inline int hamming_distance(const uint64_t* a, const uint64_t* b, int words)
+{
+    int dist = 0;
+    for(int k = 0; k < words; ++k) dist += popcount64(a[k] ^ b[k]);
+    return dist;
+}
+
+// Describes every keypoint with the 5x5 patch around it, minus the center value, for every channel.
+// Same values and layout as the descriptors of harris_corner_detector.
+descriptor_set describe_patches(image m, const point* p, const float* score, int n);
+
+// L1 distance, or squared L2 distance, between two descriptor rows of the given stride.
+float descriptor_distance(const float* a, const float* b, int stride, distance_metric metric);
+
+// Brute force nearest neighbours of every descriptor of a among the descriptors of b.
+// Distances are computed in cache sized tiles of a x b, with AVX2 when built with it.
+// Binary sets are compared by hamming distance, whatever the metric.
+// a and b must hold descriptors of the same type and stride.
+// nearest_pair* nn: output, a.n entries. Ties keep the lowest index in b.
+void nearest_descriptors(descriptor_set a, descriptor_set b, distance_metric metric, nearest_pair* nn);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef FAST_H
+#define FAST_H
+
+#include "image.h"
+#include "harris.h"
+#include "descriptor.h"
+
+// FAST segment test corners: pixels with an arc of at least arc contiguous pixels, on the
+// 16 pixel circle of radius 3 around them, that are all brighter or all darker by more than thresh.
+// float thresh: intensity difference in [0, 1], on the mean of the channels.
+// int arc: 9 to 12, the FAST-9 to FAST-12 variants.
+// int nms: 1 to keep only corners with the highest score among their 8 neighbours.
+// int subpixel: 1 to refine the corners to sub-pixel positions on the score map, see refine_keypoints.
+// float** score: if not NULL, returns the score of every corner, the smallest difference along its best arc.
+// The test is strict, so the corner passes every thresh below its score, in steps of 1/255.
+// returns: the corners in raster order.
+point* fast_corners(image m, float thresh, int arc, int nms, int subpixel, float** score, int* n);
+
+// FAST corners with the same 5x5 patch descriptors as the harris detector.
+// int cell, per_cell: grid bucketing of the corners, no bucketing if cell <= 0.
+descriptor_set fast_corner_detector_set(image m, float thresh, int arc, int nms, int cell, int per_cell);
+descriptor* fast_corner_detector(image m, float thresh, int arc, int nms, int cell, int per_cell, int* n);
+
+#endif
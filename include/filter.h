@@ -21,4 +21,7 @@ image dilate_image(image m, int times);
 image erode_image(image m, int times);
 image skeletonize_image(image m);
 
+// maximum of the (2w+1)x(2w+1) window around every pixel, in time independent of w
+image max_filter_image(image m, int w);
+
 #endif
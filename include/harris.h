@@ -2,6 +2,7 @@
 #define HARRIS_H
 
 #include "image.h"
+#include "descriptor.h"
 
 // A descriptor for a point in an image.
 // point p: x,y coordinates of the image pixel.
@@ -13,13 +14,32 @@ typedef struct {
     float* data;
 } descriptor;
 
+typedef enum {
+    HARRIS_RESPONSE,
+    SHI_TOMASI_RESPONSE, // smallest eigenvalue of the structure matrix
+} corner_response_type;
+
 image make_structure_matrix(image m, float sigma);
 image harris_cornerness_response(image S);
+// Approximates harris_cornerness_response(make_structure_matrix(m, sigma)) with gradients, products,
+// smoothing and response fused and computed in cache sized tiles. The smoothing is an exact box blur
+// of the width gaussian_noise_reduce picks, while gaussian_noise_reduce blurs rows in place and
+// subtracts already blurred rows from its running sum, so responses differ slightly.
+image corner_response(image m, float sigma, corner_response_type type);
 image harris_nms_image(image m, int w);
 descriptor* harris_corner_detector(image m, float sigma, float thresh, int nms, int* n);
+// the corners of harris_corner_detector in raster order, with their response in score if not NULL.
+// corner_response_type type: HARRIS_RESPONSE, or SHI_TOMASI_RESPONSE to threshold the smallest eigenvalue.
+// int subpixel: 1 to refine the corners to sub-pixel positions on the response, see refine_keypoints.
+point* harris_corners(image m, float sigma, corner_response_type type, float thresh, int nms, int subpixel, float** score, int* n);
+// same corners and descriptors as harris_corner_detector, in one contiguous descriptor_set
+descriptor_set harris_corner_detector_set(image m, float sigma, float thresh, int nms);
 
 void draw_corners(image* m, descriptor* d, int n);
+void draw_corner_set(image* m, descriptor_set s);
 
+// copies a descriptor_set into separately allocated descriptors, free with free_descriptors
+descriptor* descriptor_array(descriptor_set s);
 void free_descriptors(descriptor* d, int n);
 
 #endif
@@ -0,0 +1,76 @@
+#ifndef HOMOGRAPHY_H
+#define HOMOGRAPHY_H
+
+#include "image.h"
+#include "matrix.h"
+
+// A 3x3 homography held by value, so that projecting points allocates nothing.
+// float h[3][3]: row major, projects (x, y) by multiplying (x, y, 1) and dividing by the third coordinate.
+typedef struct {
+    float h[3][3];
+} hom3;
+
+static inline hom3 hom3_identity(void)
+{
+    hom3 H = {{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}};
+    return H;
+}
+
+static inline hom3 hom3_translation(float dx, float dy)
+{
+    hom3 H = {{{1, 0, dx}, {0, 1, dy}, {0, 0, 1}}};
+    return H;
+}
+
+// a*b, the homography that applies b first and then a
+static inline hom3 hom3_multiply(hom3 a, hom3 b)
+{
+    hom3 c;
+    for(int i = 0; i < 3; ++i) {
+        for(int j = 0; j < 3; ++j) {
+            c.h[i][j] = a.h[i][0]*b.h[0][j] + a.h[i][1]*b.h[1][j] + a.h[i][2]*b.h[2][j];
+        }
+    }
+    return c;
+}
+
+// Inverts H by its adjugate, in double because translations of hundreds of pixels sit next to
+// perspective terms of 1e-4. Returns 0 and leaves inv untouched if H is singular.
+static inline int hom3_invert(hom3 H, hom3* inv)
+{
+    double a[3][3];
+    for(int i = 0; i < 9; ++i) a[i/3][i%3] = H.h[i/3][i%3];
+    double c00 = a[1][1]*a[2][2] - a[1][2]*a[2][1];
+    double c01 = a[1][2]*a[2][0] - a[1][0]*a[2][2];
+    double c02 = a[1][0]*a[2][1] - a[1][1]*a[2][0];
+    double det = a[0][0]*c00 + a[0][1]*c01 + a[0][2]*c02;
+    if(det == 0 || det != det) return 0;
+    double s = 1. / det;
+    inv->h[0][0] = c00*s;
+    inv->h[0][1] = (a[0][2]*a[2][1] - a[0][1]*a[2][2])*s;
+    inv->h[0][2] = (a[0][1]*a[1][2] - a[0][2]*a[1][1])*s;
+    inv->h[1][0] = c01*s;
+    inv->h[1][1] = (a[0][0]*a[2][2] - a[0][2]*a[2][0])*s;
+    inv->h[1][2] = (a[0][2]*a[1][0] - a[0][0]*a[1][2])*s;
+    inv->h[2][0] = c02*s;
+    inv->h[2][1] = (a[0][1]*a[2][0] - a[0][0]*a[2][1])*s;
+    inv->h[2][2] = (a[0][0]*a[1][1] - a[0][1]*a[1][0])*s;
+    return 1;
+}
+
+static inline point hom3_project(hom3 H, point p)
+{
+    float w = H.h[2][0]*p.x + H.h[2][1]*p.y + H.h[2][2];
+    point q = { (H.h[0][0]*p.x + H.h[0][1]*p.y + H.h[0][2]) / w,
+                (H.h[1][0]*p.x + H.h[1][1]*p.y + H.h[1][2]) / w };
+    return q;
+}
+
+// Projects n points, 4 at a time with SSE. in and out may be the same array.
+void project_points(hom3 H, const point* in, point* out, int n);
+
+// conversions for code that holds homographies in a 3x3 matrix
+hom3 matrix_to_hom3(matrix m);
+matrix hom3_to_matrix(hom3 H);
+
+#endif
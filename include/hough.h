@@ -2,15 +2,48 @@
 #define HOUGH_H
 
 #include "image.h"
+#include "rle.h"
 
 typedef struct {
     int w, h;
     unsigned int* histogram;
 } accumulator;
 
+typedef struct {
+    float x, y, r;
+    int votes;
+} circle;
+
 accumulator hough_transform(image m);
 line* hough_line_detect(image m, int threshold, int* num_lines);
+// int k: only return the k strongest lines, strongest first. 0 for all lines.
+line* hough_line_detect_k(image m, int threshold, int k, int* num_lines);
+
+// same as above for an edge image in runs, e.g. make_rle_image(canny_image(m, 1), 0.5f)
+accumulator hough_transform_rle(rle_image m);
+line* hough_line_detect_rle(rle_image m, int threshold, int k, int* num_lines);
+
+// Progressive probabilistic hough transform, returns line segments instead of infinite lines.
+// int threshold: votes needed before a line is confirmed and traced.
+// int min_length: shortest segment to keep, in pixels.
+// int max_gap: longest run of missing edge pixels allowed inside a segment.
+// int max_lines: stop after this many segments, 0 for no limit.
+line* hough_line_segments_detect(image m, int threshold, int min_length, int max_gap, int max_lines, int* num_lines);
+
+// Gradient hough transform for circles.
+// image m: the image the edges were computed from, used for the gradient directions.
+// image edges: binary edge image, e.g. the output from canny.
+accumulator hough_circle_transform(image m, image edges, int min_radius, int max_radius);
+// Finds the centers with hough_circle_transform and picks the radius of each center with the
+// largest fraction of its circumference on edge pixels.
+// int threshold: votes needed for a center, 0 for the width of the radius range.
+circle* hough_circle_detect(image m, image edges, int min_radius, int max_radius, int threshold, int* num_circles);
 
 void draw_hough_lines(image* m, line* lines, int num_lines, float r, float g, float b);
+void draw_hough_circles(image* m, circle* circles, int num_circles, float r, float g, float b);
+
+// free the arrays returned by the detectors above
+void free_lines(line* lines);
+void free_circles(circle* circles);
 
 #endif
@@ -85,6 +85,9 @@ void flip_image(image* m);
 // resizing
 image nn_resize(image m, int w, int h);
 image bilinear_resize(image m, int w, int h);
+// Averages factor x factor blocks, an antialiased downscale by a whole factor that reads every pixel once.
+// Drops the last m.w % factor columns and m.h % factor rows.
+image box_downscale(image m, int factor);
 
 image rotate_image(image m, float rad);
 image rotate_image_left_or_right(image m, int direction); // 0 = left, 1 = right
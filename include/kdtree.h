@@ -0,0 +1,53 @@
+#ifndef KDTREE_H
+#define KDTREE_H
+
+#include "descriptor.h"
+
+// A node of a k-d tree. Inner nodes split on one dimension, leaves hold a bucket of descriptor indexes.
+// int dim: the dimension to split on, -1 for leaves.
+// float split: descriptors with value < split go left, the others go right.
+// int left, right: indexes of the children in the node array of the tree.
+// int* bucket: stretchy buffer of descriptor indexes in a leaf.
+typedef struct {
+    int dim;
+    float split;
+    int left, right;
+    int* bucket;
+} kd_node;
+
+// A randomized k-d forest over a growing set of descriptors, for approximate nearest neighbour search.
+// Every tree splits on a dimension picked at random among the ones with the highest variance,
+// and queries search all trees at once in best bin first order until the check budget is spent.
+// descriptor_set points: the indexed descriptors, owned by the forest.
+// int capacity: number of descriptors points has room for.
+// int num_trees: number of randomized trees.
+// int checks: number of descriptors compared per query, at least.
+// distance_metric metric: distance used for searching.
+// kd_node** trees: stretchy buffers of nodes for every tree, the root is node 0.
+// int built: number of descriptors when the trees were last rebuilt.
+// unsigned int seed: random state for picking split dimensions.
+typedef struct {
+    descriptor_set points;
+    int capacity;
+    int num_trees, checks;
+    distance_metric metric;
+    kd_node** trees;
+    int built;
+    unsigned int seed;
+} kd_forest;
+
+kd_forest make_kd_forest(int d, int num_trees, int checks, distance_metric metric);
+void free_kd_forest(kd_forest* f);
+
+// Adds all descriptors of s, which must be float descriptors, to the forest. Indexes of earlier descriptors stay valid.
+// New descriptors are inserted into the existing trees, which are rebuilt every time the forest doubles in size.
+void kd_forest_add(kd_forest* f, descriptor_set s);
+
+// Approximate k nearest neighbours of every descriptor of q, nearest first.
+// int* indexes, float* dists: output, q.n*k entries. Missing neighbours are -1 with distance FLT_MAX.
+void kd_forest_knn(kd_forest f, descriptor_set q, int k, int* indexes, float* dists);
+
+// Approximate nearest and second nearest neighbour of every descriptor of q, like nearest_descriptors.
+void kd_forest_nearest(kd_forest f, descriptor_set q, nearest_pair* nn);
+
+#endif
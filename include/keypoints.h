@@ -0,0 +1,31 @@
+#ifndef KEYPOINTS_H
+#define KEYPOINTS_H
+
+#include "image.h"
+
+// Keypoint selection, so that matching and RANSAC see a bounded number of keypoints whatever the texture.
+// All functions work in place on parallel point and score arrays, keep the selected keypoints
+// in their original order, and return the number of keypoints kept at the start of p and score.
+
+// Keeps the target highest scoring keypoints, with a min heap of size target.
+int retain_best_keypoints(point* p, float* score, int n, int target);
+
+// Keeps at most per_cell of the highest scoring keypoints in every cell x cell block of a w x h image,
+// with a min heap of size per_cell for every cell. Keeps all if cell or per_cell <= 0.
+int grid_bucket_keypoints(point* p, float* score, int n, int w, int h, int cell, int per_cell);
+
+// Adaptive non-maximal suppression: keeps the target keypoints with the largest suppression radius,
+// the distance to the nearest keypoint that is stronger by a factor 1/robust, so that strong keypoints
+// are kept but also spread over the image. Radii come from a k-d tree that knows the highest score
+// in every subtree, in O(n log n) overall.
+// float robust: 0.9 is common, a keypoint only suppresses another if its score is larger by a factor
+//               1/robust for positive scores, or by a factor robust in magnitude for negative ones.
+int anms_keypoints(point* p, float* score, int n, int target, float robust);
+
+// Sub-pixel refinement: moves every keypoint to the peak of a quadratic fitted to the 3x3 response
+// around its pixel, by at most half a pixel. Keypoints without a maximum in their fit stay where they are.
+// Keypoints are gathered and solved in batches so that the fits vectorize.
+// image response: single channel response map of the image the keypoints were detected on.
+void refine_keypoints(image response, point* p, int n);
+
+#endif
@@ -1,11 +1,18 @@
 #ifndef MATRIX_H
 #define MATRIX_H
 
+// A row major matrix.
+// float** data: row pointers, data[i][j] is row i column j. make_matrix allocates the pointers and
+//               the values in one block, rows stride floats apart and 32 byte aligned, freed with free_matrix.
+// int stride: distance in floats between rows of make_matrix, cols rounded up to a multiple of 8.
+//             Functions only index through data, so matrices with other row pointers work too.
 typedef struct matrix {
     int rows, cols;
     float** data;
+    int stride;
 } matrix;
 
+// data is NULL only if the allocation fails, a matrix with no rows still allocates.
 matrix make_matrix(int rows, int cols);
 matrix make_identity(int n);
 matrix make_translation_homography(float dx, float dy);
@@ -14,8 +21,13 @@ void free_matrix(matrix* m);
 
 matrix transpose_matrix(matrix m);
 matrix multiply_matrix(matrix a, matrix b);
+// c = alpha*op(a)*op(b) + beta*c, where op transposes a if ta and b if tb, so that callers never build
+// a transpose. Blocked for the cache with an inner loop over columns that vectorizes, and split over
+// threads when the product is large. c must be op(a).rows x op(b).cols.
+void gemm(int ta, int tb, float alpha, matrix a, matrix b, float beta, matrix c);
 matrix invert_matrix(matrix m);
 
+// least squares solution of M x = b by householder QR, see qr_solve. Empty if M has dependent columns.
 matrix least_squares(matrix M, matrix b);
 
 #endif
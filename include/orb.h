@@ -0,0 +1,16 @@
+#ifndef ORB_H
+#define ORB_H
+
+#include "image.h"
+#include "descriptor.h"
+
+#define ORB_BITS 256
+
+// Oriented binary descriptors, in the style of ORB.
+// Every bit compares the 5x5 box smoothed intensity at a pair of points of a fixed, gaussian distributed
+// pattern in the 31x31 patch around the keypoint. The pattern is rotated to the orientation of the intensity
+// centroid of the patch, so the descriptors are invariant to in-plane rotation.
+// returns: a BINARY_DESCRIPTOR set of ORB_BITS bits per keypoint, 32 bytes instead of 300 for 5x5 rgb patches.
+descriptor_set describe_orb(image m, const point* p, const float* score, int n);
+
+#endif
@@ -4,7 +4,18 @@
 #include "image.h"
 
 #include "matrix.h"
+#include "homography.h"
+#include "solve.h"
+#include "warp.h"
+#include "remap.h"
+#include "canvas.h"
+#include "blend.h"
 #include "harris.h"
+#include "kdtree.h"
+#include "fast.h"
+#include "orb.h"
+#include "keypoints.h"
+#include "pyramid.h"
 
 // A match between two points in an image.
 // point p, q: x,y coordinates of the two matching pixels.
@@ -16,17 +27,118 @@ typedef struct {
     float dist;
 } match;
 
+typedef enum {
+    HARRIS_DETECTOR,
+    FAST_DETECTOR,
+    SHI_TOMASI_DETECTOR // harris_corners on the smallest eigenvalue of the structure matrix
+} keypoint_detector;
+
+// Parameters of panorama_image.
+// keypoint_detector detector: corner detector run on both images.
+// descriptor_type descriptor: FLOAT_DESCRIPTOR for 5x5 patches matched by L1 distance,
+//                             BINARY_DESCRIPTOR for oriented 256 bit descriptors matched by hamming distance.
+// float sigma, thresh: smoothing and response threshold of the harris and shi-tomasi detectors.
+// int nms: their non-maximum suppression window, FAST always suppresses over 3x3.
+// float fast_thresh: intensity threshold in [0, 1] of the FAST detector.
+// int fast_arc: 9 to 12, contiguous pixels of the FAST segment test.
+// int cell, per_cell: keeps at most per_cell corners per cell x cell block, 0 to keep all.
+// int max_keypoints: hard budget of corners per image after bucketing, 0 for no budget.
+// int subpixel: 1 to refine corners to sub-pixel positions, which allows a tighter inlier_thresh.
+// int anms: 1 to meet the budget with adaptive non-maximal suppression instead of the best scores.
+// int levels: detects corners on this many levels of a gaussian pyramid, 1 for full resolution only.
+// float level_scale: size ratio between pyramid levels.
+// int first_level: first pyramid level to detect on, skipping the slow high resolution levels.
+// float inlier_thresh: distance in pixels for a projected match to be an inlier.
+// int iters, cutoff: most RANSAC iterations, and number of inliers to stop at, 0 to stop adaptively only.
+// float confidence, int prosac, unsigned int seed: see ransac_options.
+// int draw_matches: 1 to save the corners and matches to matches.png.
+// int neighbors: panorama_images matches every image with the next neighbors images in the sequence,
+//                pairs beyond the next one only if they overlap after chaining the sequential pairs.
+// int min_inliers: fewest RANSAC inliers for a pair of images to be connected.
+// int coarse: 4 to 8 to register coarse-to-fine: a first homography from corners of the images
+//             downscaled by about this factor, refined by full resolution corners detected in the
+//             overlap it predicts and matched within search_radius of their predicted position.
+//             Pyramid detection (levels) only applies to full resolution registration, and
+//             draw_matches shows the coarse matches against the final homography.
+// float search_radius: pixels around the predicted position searched by coarse-to-fine matching.
+// blend_mode blend: how overlapping images are combined, BLEND_NONE by default as before blending existed.
+// int bands: pyramid levels of BLEND_MULTIBAND, seams blend over about 2^bands pixels.
+typedef struct {
+    keypoint_detector detector;
+    descriptor_type descriptor;
+    float sigma, thresh;
+    int nms;
+    float fast_thresh;
+    int fast_arc;
+    int cell, per_cell;
+    int max_keypoints, anms;
+    int subpixel;
+    int levels;
+    float level_scale;
+    int first_level;
+    float inlier_thresh;
+    int iters, cutoff;
+    float confidence;
+    int prosac;
+    unsigned int seed;
+    int draw_matches;
+    int neighbors;
+    int min_inliers;
+    int coarse;
+    float search_radius;
+    blend_mode blend;
+    int bands;
+} panorama_options;
+
+// Parameters of ransac_homography.
+// float thresh: distance in pixels for a projected match to be an inlier.
+// int iters: most hypotheses to score.
+// int cutoff: stops once more than cutoff inliers are found, 0 to stop adaptively only.
+// float confidence: stops once an all inlier sample was drawn with this probability,
+//                   given the best inlier ratio so far.
+// int prosac: 1 to sort matches by descriptor distance and sample the best first.
+// unsigned int seed: the same seed and matches give the same homography on any number of threads.
+typedef struct {
+    float thresh;
+    int iters, cutoff;
+    float confidence;
+    int prosac;
+    unsigned int seed;
+} ransac_options;
+
+panorama_options default_panorama_options();
+ransac_options default_ransac_options();
+
 // projection functions
+// project_point takes a matrix for older callers, hom3_project and project_points do the same without allocating.
 point project_point(matrix H, point p);
-matrix compute_homography(match* matches, int n);
+// fits H to the matches by least squares, returns 0 if they do not determine a homography
+int compute_homography(match* matches, int n, hom3* H);
+// Robust homography from 4 match samples scored in parallel, refit on the inliers of the best.
+// returns: the number of inliers, moved to the front of m. H is only set if a model was found.
+int ransac_homography(match* m, int n, ransac_options r, hom3* H);
 image cylindrical_project(image m, float f);
 
 // stitching functions
-int model_inliers(matrix H, match* m, int n, float thresh);
-image combine_images(image a, image b, matrix H);
+int model_inliers(hom3 H, match* m, int n, float thresh);
+// Warps b onto a with H, which maps a to b. Returns an empty image if H is not invertible.
+image combine_images(image a, image b, hom3 H, blend_mode blend, int bands);
 match* match_descriptors(descriptor* a, int an, descriptor* b, int bn, int* mn);
-image panorama_image(image a, image b, float sigma, float thresh, int nms, float inlier_thresh, int iters, int cutoff, int draw_matches);
+match* match_descriptor_sets(descriptor_set a, descriptor_set b, distance_metric metric, float ratio, int* mn);
+match* match_descriptor_index(descriptor_set a, kd_forest f, float ratio, int* mn);
+// Stitches b onto a. Takes panorama_options because the detector and pipeline choices outgrew
+// a parameter list, panorama_image_params keeps the parameters it took before.
+image panorama_image(image a, image b, panorama_options o);
+image panorama_image_params(image a, image b, float sigma, float thresh, int nms, float inlier_thresh, int iters, int cutoff, int draw_matches);
+// Stitches a sequence of overlapping images. Features are detected once per image, candidate pairs
+// are registered in parallel, and a spanning tree of the strongest pairs chains every image to the
+// middle one. Each image is then warped once into the final canvas and blended with the images before it.
+// Images that no pair connects are left out.
+image panorama_images(image* m, int n, panorama_options o);
+// panorama_images onto a tiled canvas that keeps about memory bytes of tiles in memory,
+// for panoramas too large to hold as one image.
+canvas panorama_canvas(image* m, int n, panorama_options o, size_t memory);
 
-image draw_inliers(image a, image b, matrix H, match* m, int n, float thresh);
+image draw_inliers(image a, image b, hom3 H, match* m, int n, float thresh);
 
 #endif
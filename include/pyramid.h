@@ -0,0 +1,28 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include "image.h"
+
+// A gaussian image pyramid.
+// int levels: the number of levels, level 0 has the size of the input.
+// float scale: size ratio between consecutive levels, 2 for octaves.
+// image* level: the levels, every one blurred and resampled from the one before.
+// image scratch: blur buffer the size of level 0, kept so that rebuilding allocates nothing.
+typedef struct {
+    int levels;
+    float scale;
+    image* level;
+    image scratch;
+} image_pyramid;
+
+// Builds up to levels levels, stopping early before a level would be smaller than 16 pixels.
+image_pyramid make_image_pyramid(image m, int levels, float scale);
+// Rebuilds the pyramid from a new image, reusing the buffers if the image has the same size.
+void update_image_pyramid(image_pyramid* p, image m);
+void free_image_pyramid(image_pyramid* p);
+
+// Maps a point of a level to level 0 coordinates, and back.
+point pyramid_to_base(image_pyramid p, int level, point q);
+point base_to_pyramid(image_pyramid p, int level, point q);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef REMAP_H
+#define REMAP_H
+
+#include "image.h"
+
+#define REMAP_BITS 5 // fractional bits of the source coordinates
+#define REMAP_STEPS (1 << REMAP_BITS)
+
+// A precomputed warp: the source position of every destination pixel, in fixed point, so that
+// applying it costs one bilinear gather per pixel whatever computed the positions.
+// int w, h: destination size.
+// int src_w, src_h: size of the source images it applies to, at most 32767.
+// short* xy: top left pixel of the bilinear footprint of every destination pixel, x then y.
+// unsigned short* frac: fy*REMAP_STEPS + fx in 1/REMAP_STEPS pixels,
+//                       REMAP_STEPS*REMAP_STEPS for pixels that fall outside the source.
+typedef struct {
+    int w, h;
+    int src_w, src_h;
+    short* xy;
+    unsigned short* frac;
+} remap_map;
+
+// makes a map with every pixel outside the source, to be filled with set_remap_point.
+// The map has no data if src_w or src_h is larger than 32767.
+remap_map make_remap_map(int w, int h, int src_w, int src_h);
+void free_remap_map(remap_map* m);
+// maps destination pixel x, y to source position sx, sy, outside the source unless 0 <= sx <= src_w-1
+// and 0 <= sy <= src_h-1
+void set_remap_point(remap_map* m, int x, int y, float sx, float sy);
+
+// Applies the map to an image of size src_w x src_h. Pixels outside the source are 0.
+// Returns an empty image if src has another size.
+// The weights of a row are expanded once and reused for every channel, in loops that vectorize.
+image remap(image src, const remap_map* m);
+
+// The map of cylindrical_project for a w x h image and focal length f, built on first use and kept
+// in a small cache keyed by w, h and f. The map is pinned in the cache, so that other threads cannot
+// evict it, until it is given back with release_remap_map.
+const remap_map* cylindrical_remap_map(int w, int h, float f);
+void release_remap_map(const remap_map* m);
+// frees the cached maps that are not pinned
+void clear_remap_cache(void);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef RLE_H
+#define RLE_H
+
+#include "image.h"
+
+// A run of foreground pixels covering columns [xs, xe) of a row.
+typedef struct {
+    int xs, xe;
+} run;
+
+// Run-length encoded binary image.
+// int n: total number of runs.
+// run* runs: runs sorted by row, then by column.
+// int* row_start: the runs of row y are runs[row_start[y]] up to runs[row_start[y+1]].
+typedef struct {
+    int w, h;
+    int n;
+    run* runs;
+    int* row_start;
+} rle_image;
+
+// pixels of the first channel of m that are > thresh become foreground
+rle_image make_rle_image(image m, float thresh);
+image rle_to_image(rle_image r);
+rle_image copy_rle_image(rle_image r);
+void free_rle_image(rle_image* r);
+
+int rle_count_pixels(rle_image r);
+
+// morphological transformations with a 3x3 cross, like dilate_image and erode_image.
+// pixels outside the image never dilate into it, and never erode it.
+rle_image rle_dilate(rle_image r, int times);
+rle_image rle_erode(rle_image r, int times);
+
+#endif
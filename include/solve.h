@@ -0,0 +1,38 @@
+#ifndef SOLVE_H
+#define SOLVE_H
+
+#include "matrix.h"
+
+// Dense solvers that factor in place and never form an inverse. Sums are accumulated in double.
+// The ones that can fail return 1 on success and 0 if the system is singular.
+
+// Solves A x = B for a symmetric positive definite A, such as the normal equations XtX.
+// A is overwritten by its cholesky factor L in the lower triangle, B by the solution.
+// matrix A: n x n, only the lower triangle is read.
+// matrix B: n x k right hand sides.
+int cholesky_solve(matrix A, matrix B);
+
+// Householder QR of an m x n matrix, m >= n: R is left on and above the diagonal, the reflectors
+// below it with their scales in tau, which holds n floats.
+void householder_qr(matrix A, float* tau);
+
+// Least squares solution of A x = B for a tall A, without squaring its condition number like the
+// normal equations do. A is overwritten by its QR, the first n rows of B by the solution.
+// matrix A: m x n, m >= n.
+// matrix B: m x k right hand sides.
+int qr_solve(matrix A, matrix B);
+
+// One-sided Jacobi SVD of an m x n matrix, m >= n, for small n: A is overwritten by U*diag(s),
+// V by the right singular vectors in its columns. The singular values in s are not sorted.
+// float* s: n floats.
+// matrix V: n x n.
+void svd_jacobi(matrix A, float* s, matrix V);
+
+// Unit vector x minimizing |A x|, the right singular vector of the smallest singular value.
+// Tall matrices are first reduced to their n x n R factor. A is overwritten.
+// float* x: A.cols floats.
+// returns: the smallest singular value over the next smallest, near 0 when x is well determined
+//          and near 1 when the smallest two are not separated, e.g. for degenerate data.
+float null_vector(matrix A, float* x);
+
+#endif
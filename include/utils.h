@@ -1,6 +1,8 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stddef.h>
+
 #define MIN(a,b) (((a) < (b)) ? (a) : (b))
 #define MAX(a,b) (((a) > (b)) ? (a) : (b))
 
@@ -10,5 +12,9 @@ float max3f(float a, float b, float c);
 float min3f(float a, float b, float c);
 float max4f(float a, float b, float c, float d);
 float min4f(float a, float b, float c, float d);
+unsigned int xorshift32(unsigned int* state);
+// Zeroed block aligned to alignment, a power of two, to be freed with free. A 0 byte block still
+// allocates, so that only a failed allocation returns NULL.
+void* aligned_calloc(size_t alignment, size_t bytes);
 
 #endif
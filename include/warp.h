@@ -0,0 +1,27 @@
+#ifndef WARP_H
+#define WARP_H
+
+#include "image.h"
+#include "homography.h"
+
+// A rectangle of pixels: columns x to x+w-1 and rows y to y+h-1.
+typedef struct {
+    int x, y, w, h;
+} rect;
+
+// the whole image as a rect
+rect image_rect(image m);
+// the pixels in both a and b, with w or h 0 if there are none
+rect intersect_rect(rect a, rect b);
+
+// Writes the pixels of dst inside roi that H maps into src, sampled bilinearly for all channels at once.
+// Pixels that map outside src are left as they are, so several images can be warped onto one canvas.
+// The destination is split in tiles that run in parallel, tiles outside the outline of src are skipped,
+// and source coordinates are stepped along the rows in homogeneous coordinates.
+// hom3 H: maps destination pixels to source pixels.
+void warp_perspective(image src, hom3 H, image dst, rect roi);
+
+// 0 if no pixel of r maps into src through H, by the same outline test that skips tiles in warp_perspective.
+int warp_reaches(image src, hom3 H, rect r);
+
+#endif
@@ -0,0 +1,373 @@
+#include "blend.h"
+
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define BLEND_TILE CANVAS_TILE
+#define BLEND_MAX_BANDS 7
+#define MIN_LEVEL_SIZE 4
+
+image feather_weights(int w, int h)
+{
+    image m = make_image(w, h, 1);
+    for(int y = 0; y < h; ++y) {
+        float wy = 1 - fabsf(2*(y + .5f)/h - 1);
+        for(int x = 0; x < w; ++x) {
+            m.data[(size_t)y*w + x] = wy*(1 - fabsf(2*(x + .5f)/w - 1));
+        }
+    }
+    return m;
+}
+
+// Copies pixels r of a dense image, or of cv if it is not NULL, to out of size r.w x r.h.
+// Pixels of canvas tiles that were never written read as 0.
+static void read_rect(image m, canvas* cv, rect r, image out)
+{
+    if(!cv) {
+        for(int k = 0; k < out.c; ++k) {
+            for(int y = 0; y < r.h; ++y) {
+                memcpy(out.data + ((size_t)k*r.h + y)*r.w, m.data + ((size_t)k*m.h + r.y + y)*m.w + r.x, r.w*sizeof(float));
+            }
+        }
+        return;
+    }
+    for(int ty = r.y / CANVAS_TILE; ty <= (r.y + r.h - 1) / CANVAS_TILE; ++ty) {
+        for(int tx = r.x / CANVAS_TILE; tx <= (r.x + r.w - 1) / CANVAS_TILE; ++tx) {
+            rect t = canvas_tile_rect(cv, tx, ty), s = intersect_rect(t, r);
+            image tile = acquire_canvas_tile(cv, tx, ty, 0);
+            for(int k = 0; k < out.c; ++k) {
+                for(int y = s.y; y < s.y + s.h; ++y) {
+                    float* dst = out.data + ((size_t)k*r.h + y - r.y)*r.w + s.x - r.x;
+                    if(!tile.data) memset(dst, 0, s.w*sizeof(float));
+                    else memcpy(dst, tile.data + ((size_t)k*CANVAS_TILE + y - t.y)*CANVAS_TILE + s.x - t.x, s.w*sizeof(float));
+                }
+            }
+            if(tile.data) release_canvas_tile(cv, tx, ty);
+        }
+    }
+}
+
+// the reverse of read_rect, allocating canvas tiles as needed
+static void write_rect(image m, canvas* cv, rect r, image in)
+{
+    if(!cv) {
+        for(int k = 0; k < in.c; ++k) {
+            for(int y = 0; y < r.h; ++y) {
+                memcpy(m.data + ((size_t)k*m.h + r.y + y)*m.w + r.x, in.data + ((size_t)k*r.h + y)*r.w, r.w*sizeof(float));
+            }
+        }
+        return;
+    }
+    for(int ty = r.y / CANVAS_TILE; ty <= (r.y + r.h - 1) / CANVAS_TILE; ++ty) {
+        for(int tx = r.x / CANVAS_TILE; tx <= (r.x + r.w - 1) / CANVAS_TILE; ++tx) {
+            rect t = canvas_tile_rect(cv, tx, ty), s = intersect_rect(t, r);
+            image tile = acquire_canvas_tile(cv, tx, ty, 1);
+            for(int k = 0; k < in.c; ++k) {
+                for(int y = s.y; y < s.y + s.h; ++y) {
+                    memcpy(tile.data + ((size_t)k*CANVAS_TILE + y - t.y)*CANVAS_TILE + s.x - t.x,
+                           in.data + ((size_t)k*r.h + y - r.y)*r.w + s.x - r.x, s.w*sizeof(float));
+                }
+            }
+            release_canvas_tile(cv, tx, ty);
+        }
+    }
+}
+
+// blurs m with [1 4 6 4 1]/16 and halves it, clamping at the edges
+static image reduce_level(image m)
+{
+    static const float k[5] = { 1/16.f, 4/16.f, 6/16.f, 4/16.f, 1/16.f };
+    const int w = (m.w + 1)/2, h = (m.h + 1)/2;
+    image tmp = make_image(w, m.h, m.c), out = make_image(w, h, m.c);
+    for(int i = 0; i < m.c*m.h; ++i) {
+        const float* in = m.data + (size_t)i*m.w;
+        float* row = tmp.data + (size_t)i*w;
+        for(int x = 0; x < w; ++x) {
+            float v = 0;
+            for(int j = 0; j < 5; ++j) v += k[j]*in[clamp(2*x + j - 2, 0, m.w - 1)];
+            row[x] = v;
+        }
+    }
+    for(int c = 0; c < m.c; ++c) {
+        const float* plane = tmp.data + (size_t)c*w*m.h;
+        for(int y = 0; y < h; ++y) {
+            float* row = out.data + ((size_t)c*h + y)*w;
+            for(int x = 0; x < w; ++x) row[x] = 0;
+            for(int j = 0; j < 5; ++j) {
+                const float* in = plane + (size_t)clamp(2*y + j - 2, 0, m.h - 1)*w;
+                #pragma omp simd
+                for(int x = 0; x < w; ++x) row[x] += k[j]*in[x];
+            }
+        }
+    }
+    free_image(&tmp);
+    return out;
+}
+
+// doubles m to w x h with the same kernel, interpolating the pixels between the samples of m
+static image expand_level(image m, int w, int h)
+{
+    image tmp = make_image(w, m.h, m.c), out = make_image(w, h, m.c);
+    for(int i = 0; i < m.c*m.h; ++i) {
+        const float* in = m.data + (size_t)i*m.w;
+        float* row = tmp.data + (size_t)i*w;
+        for(int x = 0; x < w; ++x) {
+            int j = x/2;
+            if(x & 1) row[x] = .5f*(in[j] + in[MIN(j + 1, m.w - 1)]);
+            else row[x] = .125f*in[MAX(j - 1, 0)] + .75f*in[j] + .125f*in[MIN(j + 1, m.w - 1)];
+        }
+    }
+    for(int c = 0; c < m.c; ++c) {
+        const float* plane = tmp.data + (size_t)c*w*m.h;
+        for(int y = 0; y < h; ++y) {
+            int j = y/2;
+            const float* r0 = plane + (size_t)MAX(j - 1, 0)*w;
+            const float* r1 = plane + (size_t)j*w;
+            const float* r2 = plane + (size_t)MIN(j + 1, m.h - 1)*w;
+            float* row = out.data + ((size_t)c*h + y)*w;
+            if(y & 1) {
+                #pragma omp simd
+                for(int x = 0; x < w; ++x) row[x] = .5f*(r1[x] + r2[x]);
+            }
+            else {
+                #pragma omp simd
+                for(int x = 0; x < w; ++x) row[x] = .125f*r0[x] + .75f*r1[x] + .125f*r2[x];
+            }
+        }
+    }
+    free_image(&tmp);
+    return out;
+}
+
+// The next level of a pyramid normalized by coverage: reduce(m*cov) / reduce(cov),
+// so that pixels without coverage do not pull the levels towards 0.
+static image reduce_covered(image m, image cov, image next_cov)
+{
+    image weighted = copy_image(m);
+    const int n = m.w*m.h;
+    for(int k = 0; k < m.c; ++k) {
+        #pragma omp simd
+        for(int i = 0; i < n; ++i) weighted.data[(size_t)k*n + i] *= cov.data[i];
+    }
+    image out = reduce_level(weighted);
+    free_image(&weighted);
+    const int on = out.w*out.h;
+    for(int k = 0; k < out.c; ++k) {
+        for(int i = 0; i < on; ++i) {
+            float c = next_cov.data[i];
+            out.data[(size_t)k*on + i] = c > 1e-6f ? out.data[(size_t)k*on + i] / c : 0;
+        }
+    }
+    return out;
+}
+
+// Blends b into a where b has the larger weight, by blending their Laplacian pyramids with
+// the gaussian pyramid of that mask. Where only one of them has pixels the other is filled with it,
+// and the pyramids are normalized by the coverage of both, so that the seams only blend
+// the two images and the edges of the panorama do not fade to black.
+static void multiband_blend(image a, const float* wa, image b, const float* wb, int bands)
+{
+    const int n = a.w*a.h;
+    image* ga = calloc(bands, sizeof(image));
+    image* gb = calloc(bands, sizeof(image));
+    image* gm = calloc(bands, sizeof(image));
+    image* gc = calloc(bands, sizeof(image));
+    gm[0] = make_image(a.w, a.h, 1);
+    gc[0] = make_image(a.w, a.h, 1);
+    for(int i = 0; i < n; ++i) {
+        int ca = wa[i] > 0, cb = wb[i] > 0;
+        gm[0].data[i] = cb && wb[i] > wa[i];
+        gc[0].data[i] = ca || cb;
+        for(int k = 0; k < a.c; ++k) {
+            if(!ca && cb) a.data[(size_t)k*n + i] = b.data[(size_t)k*n + i];
+            if(ca && !cb) b.data[(size_t)k*n + i] = a.data[(size_t)k*n + i];
+        }
+    }
+    ga[0] = a, gb[0] = b;
+    int levels = 1;
+    while(levels < bands && ga[levels-1].w >= 2*MIN_LEVEL_SIZE && ga[levels-1].h >= 2*MIN_LEVEL_SIZE) {
+        int l = levels++;
+        gc[l] = reduce_level(gc[l-1]);
+        gm[l] = reduce_level(gm[l-1]);
+        ga[l] = reduce_covered(ga[l-1], gc[l-1], gc[l]);
+        gb[l] = reduce_covered(gb[l-1], gc[l-1], gc[l]);
+    }
+
+    // collapse the blended Laplacian levels from the coarsest up
+    image out = make_image(ga[levels-1].w, ga[levels-1].h, a.c);
+    int ln = out.w*out.h;
+    for(int k = 0; k < a.c; ++k) {
+        for(int i = 0; i < ln; ++i) {
+            float m = gm[levels-1].data[i];
+            out.data[(size_t)k*ln + i] = ga[levels-1].data[(size_t)k*ln + i]*(1 - m) + gb[levels-1].data[(size_t)k*ln + i]*m;
+        }
+    }
+    for(int l = levels - 2; l >= 0; --l) {
+        const int w = ga[l].w, h = ga[l].h;
+        image up = expand_level(out, w, h);
+        image ua = expand_level(ga[l+1], w, h);
+        image ub = expand_level(gb[l+1], w, h);
+        free_image(&out);
+        ln = w*h;
+        for(int k = 0; k < a.c; ++k) {
+            const size_t o = (size_t)k*ln;
+            #pragma omp simd
+            for(int i = 0; i < ln; ++i) {
+                float la = ga[l].data[o + i] - ua.data[o + i];
+                float lb = gb[l].data[o + i] - ub.data[o + i];
+                up.data[o + i] += la + gm[l].data[i]*(lb - la);
+            }
+        }
+        free_image(&ua); free_image(&ub);
+        out = up;
+    }
+    for(int k = 0; k < a.c; ++k) {
+        for(int i = 0; i < n; ++i) {
+            if(gc[0].data[i] > 0) a.data[(size_t)k*n + i] = fminf(fmaxf(out.data[(size_t)k*n + i], 0), 1);
+        }
+    }
+    free_image(&out);
+    for(int l = 0; l < levels; ++l) {
+        if(l > 0) free_image(&ga[l]), free_image(&gb[l]);
+        free_image(&gm[l]); free_image(&gc[l]);
+    }
+    free(ga); free(gb); free(gm); free(gc);
+}
+
+// The blended pixels and weights of one tile, kept until every tile has read its window.
+typedef struct {
+    rect r;
+    image pixels, weight;
+} blended_tile;
+
+// Blends one tile of the destination, reading a window around it for multiband.
+// Returns a tile with no data if src does not cover it.
+static blended_tile blend_tile(image src, image hat, hom3 H, image dm, image dw, canvas* cm, canvas* cw,
+                               rect bounds, rect roi, rect t, blend_mode mode, int bands, int margin)
+{
+    blended_tile out = { t };
+    rect win = { t.x - margin, t.y - margin, t.w + 2*margin, t.h + 2*margin };
+    win = intersect_rect(win, bounds);
+    const int c = cm ? cm->c : dm.c, n = win.w*win.h;
+    image b = make_image(win.w, win.h, c), wb = make_image(win.w, win.h, 1);
+    rect local = intersect_rect(roi, win);
+    local.x -= win.x, local.y -= win.y;
+    hom3 Hw = hom3_multiply(H, hom3_translation(win.x, win.y));
+    warp_perspective(src, Hw, b, local);
+    warp_perspective(hat, Hw, wb, local);
+
+    // the tile inside the window
+    const int x0 = t.x - win.x, y0 = t.y - win.y;
+    int covered = 0;
+    for(int y = y0; y < y0 + t.h && !covered; ++y) {
+        for(int x = x0; x < x0 + t.w; ++x) covered |= wb.data[y*win.w + x] > 0;
+    }
+    if(!covered) {
+        free_image(&b); free_image(&wb);
+        return out;
+    }
+    image a = make_image(win.w, win.h, c), wa = make_image(win.w, win.h, 1);
+    read_rect(dm, cm, win, a);
+    read_rect(dw, cw, win, wa);
+
+    int overlap = 0;
+    for(int i = 0; i < n && !overlap; ++i) overlap = wa.data[i] > 0 && wb.data[i] > 0;
+    if(mode == BLEND_MULTIBAND && overlap) {
+        multiband_blend(a, wa.data, b, wb.data, bands);
+        for(int i = 0; i < n; ++i) wa.data[i] = MAX(wa.data[i], wb.data[i]);
+    }
+    else {
+        for(int i = 0; i < n; ++i) {
+            float sa = wa.data[i], sb = wb.data[i];
+            if(mode == BLEND_FEATHER && sb > 0) {
+                // running weighted average: a holds the average of the images with weights summing to sa
+                float s = sa + sb;
+                for(int k = 0; k < c; ++k) a.data[(size_t)k*n + i] = (a.data[(size_t)k*n + i]*sa + b.data[(size_t)k*n + i]*sb) / s;
+                wa.data[i] = s;
+            }
+            else if(mode != BLEND_FEATHER && sb > sa) {
+                for(int k = 0; k < c; ++k) a.data[(size_t)k*n + i] = b.data[(size_t)k*n + i];
+                wa.data[i] = sb;
+            }
+        }
+    }
+    out.pixels = crop_image(a, x0, y0, t.w, t.h);
+    out.weight = crop_image(wa, x0, y0, t.w, t.h);
+    free_image(&a); free_image(&wa); free_image(&b); free_image(&wb);
+    return out;
+}
+
+// Blends src into the dense image dm or the canvas cm, whichever is used, a row of tiles at a time.
+// A tile reads the rows of tiles within its margin, so the results of a row are held and written back
+// once every row that reads them is blended, which keeps reach + 1 rows of results in memory.
+static void blend_tiles(image src, hom3 H, image dm, image dw, canvas* cm, canvas* cw,
+                        rect bounds, rect roi, blend_mode mode, int bands)
+{
+    roi = intersect_rect(roi, bounds);
+    if(roi.w <= 0 || roi.h <= 0) return;
+    bands = clamp(bands, 1, BLEND_MAX_BANDS);
+    const int margin = mode == BLEND_MULTIBAND ? 1 << (bands + 1) : 0;
+    const int reach = (margin + BLEND_TILE - 1) / BLEND_TILE;
+
+    int tx0 = roi.x / BLEND_TILE, tx1 = (roi.x + roi.w - 1) / BLEND_TILE;
+    int ty0 = roi.y / BLEND_TILE, ty1 = (roi.y + roi.h - 1) / BLEND_TILE;
+    const int cols = tx1 - tx0 + 1;
+    blended_tile* tiles = malloc((size_t)(reach + 1)*cols*sizeof(blended_tile));
+    int* count = calloc(reach + 1, sizeof(int));
+    image hat = feather_weights(src.w, src.h);
+    for(int ty = ty0; ty <= ty1 + reach; ++ty) {
+        if(ty <= ty1) {
+            blended_tile* row = tiles + (size_t)((ty - ty0) % (reach + 1))*cols;
+            int n = 0;
+            for(int tx = tx0; tx <= tx1; ++tx) {
+                rect t = { tx*BLEND_TILE, ty*BLEND_TILE, BLEND_TILE, BLEND_TILE };
+                t = intersect_rect(t, roi);
+                if(warp_reaches(src, H, t)) row[n++].r = t;
+            }
+            count[(ty - ty0) % (reach + 1)] = n;
+            #pragma omp parallel for schedule(dynamic)
+            for(int i = 0; i < n; ++i) {
+                row[i] = blend_tile(src, hat, H, dm, dw, cm, cw, bounds, roi, row[i].r, mode, bands, margin);
+            }
+        }
+        // no row left to blend reads row ty - reach
+        const int done = ty - reach;
+        if(done < ty0) continue;
+        blended_tile* row = tiles + (size_t)((done - ty0) % (reach + 1))*cols;
+        const int n = count[(done - ty0) % (reach + 1)];
+        #pragma omp parallel for schedule(dynamic)
+        for(int i = 0; i < n; ++i) {
+            if(!row[i].pixels.data) continue;
+            write_rect(dm, cm, row[i].r, row[i].pixels);
+            write_rect(dw, cw, row[i].r, row[i].weight);
+            free_image(&row[i].pixels);
+            free_image(&row[i].weight);
+        }
+    }
+    free_image(&hat);
+    free(count);
+    free(tiles);
+}
+
+void blend_warp(image src, hom3 H, image dst, image weight, rect roi, blend_mode mode, int bands)
+{
+    if(mode == BLEND_NONE) {
+        warp_perspective(src, H, dst, roi);
+        return;
+    }
+    blend_tiles(src, H, dst, weight, NULL, NULL, image_rect(dst), roi, mode, bands);
+}
+
+void blend_warp_canvas(image src, hom3 H, canvas* dst, canvas* weight, rect roi, blend_mode mode, int bands)
+{
+    if(mode == BLEND_NONE) {
+        warp_canvas(src, H, dst, roi);
+        return;
+    }
+    image none = {0};
+    rect bounds = { 0, 0, dst->w, dst->h };
+    blend_tiles(src, H, none, none, dst, weight, bounds, roi, mode, bands);
+}
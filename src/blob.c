@@ -1,88 +1,240 @@
 #include "blob.h"
 
 #include "draw.h"
+#include "utils.h"
 #include "stretchy_buffer.h"
 
 #include <stdlib.h>
 
-cc_label* cc_label_image(image m)
+// union-find over pixel indexes, every tree is rooted at its lowest index
+static inline int cc_find(int* parent, int i)
+{
+    while(parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+static inline int cc_find_root(const int* parent, int i)
+{
+    while(parent[i] != i) i = parent[i];
+    return i;
+}
+
+static inline void cc_union(int* parent, int a, int b)
+{
+    a = cc_find(parent, a), b = cc_find(parent, b);
+    if(a < b) parent[b] = a;
+    else if(b < a) parent[a] = b;
+}
+
+// links pixel (x, y) to its foreground neighbors in row y-1
+static inline void cc_union_above(image m, int* parent, int x, int y, int connectivity)
+{
+    int i = y*m.w + x, up = i - m.w;
+    if(m.data[up] > 0.f) cc_union(parent, i, up);
+    if(connectivity == 8) {
+        if(x > 0 && m.data[up-1] > 0.f) cc_union(parent, i, up-1);
+        if(x < m.w-1 && m.data[up+1] > 0.f) cc_union(parent, i, up+1);
+    }
+}
+
+cc_label* connected_components(image m, int connectivity, image* label_map)
 {
+    const int strip_height = 32;
     int w = m.w, h = m.h, n = m.w*m.h;
-    cc_label* out_labels = NULL;
+    int num_strips = (h + strip_height - 1) / strip_height;
+    if(connectivity != 4) connectivity = 8;
 
-    int* queue = (int*)malloc(n*sizeof(int));
-    int* labels = (int*)malloc(n*sizeof(int));
-    #pragma omp parallel for
-    for(int i = 0; i < n; ++i) labels[i] = -1;
+    int* parent = malloc(n*sizeof(int));
+    int* root = malloc(n*sizeof(int));
+    int* strip_offset = calloc(num_strips + 1, sizeof(int));
 
-    int count = 0;
-    for(int i = 0; i < n; ++i) {
-        if(m.data[i] <= 0.f) continue;
-        if(labels[i] == -1) {
-            queue[0] = i;
-            int queue_count = 1;
-            cc_label label = { w, 0, h, 0, -1 };
-            while(queue_count > 0) {
-                // extract from queue and grow component
-                int p = queue[--queue_count];
-                if(labels[p] != -1) continue;
-                labels[p] = label.label = count;
-
-                int x = p % w, y = p / w;
-                label.xmin = (x < label.xmin) ? x : label.xmin;
-                label.ymin = (y < label.ymin) ? y : label.ymin;
-                label.xmax = (x > label.xmax) ? x : label.xmax;
-                label.ymax = (y > label.ymax) ? y : label.ymax;
-
-                int neighbors[] = { p+w, p-w, p+1, p-1, p+1+w, p-1+w, p+1-w, p-1-w };
-                for (int j = 0; j < 8; ++j) {
-                    int q = neighbors[j];
-                    if (m.data[q] > 0.f && labels[q] == -1) {
-                        queue[queue_count++] = q;
-                    }
-                }
+    // first pass: label every strip of rows on its own
+    #pragma omp parallel for schedule(dynamic)
+    for(int s = 0; s < num_strips; ++s) {
+        int y0 = s*strip_height, y1 = MIN(h, y0 + strip_height);
+        for(int y = y0; y < y1; ++y) {
+            for(int x = 0; x < w; ++x) {
+                int i = y*w + x;
+                parent[i] = i;
+                if(m.data[i] <= 0.f) continue;
+                if(x > 0 && m.data[i-1] > 0.f) cc_union(parent, i, i-1);
+                if(y > y0) cc_union_above(m, parent, x, y, connectivity);
             }
-            count++;
-            sb_push(out_labels, label);
         }
     }
-    free(queue);
-    free(labels);
+    // merge the components that touch across strip borders
+    for(int s = 1; s < num_strips; ++s) {
+        int y = s*strip_height;
+        for(int x = 0; x < w; ++x) {
+            if(m.data[y*w + x] > 0.f) cc_union_above(m, parent, x, y, connectivity);
+        }
+    }
+    // second pass: resolve roots and number them in raster order
+    #pragma omp parallel for schedule(dynamic)
+    for(int s = 0; s < num_strips; ++s) {
+        int count = 0, end = MIN(n, (s + 1)*strip_height*w);
+        for(int i = s*strip_height*w; i < end; ++i) {
+            root[i] = m.data[i] > 0.f ? cc_find_root(parent, i) : -1;
+            count += root[i] == i;
+        }
+        strip_offset[s + 1] = count;
+    }
+    for(int s = 0; s < num_strips; ++s) strip_offset[s + 1] += strip_offset[s];
+    int num_labels = strip_offset[num_strips];
+
+    // parent is no longer needed, reuse it to hold the label of every root
+    #pragma omp parallel for schedule(dynamic)
+    for(int s = 0; s < num_strips; ++s) {
+        int label = strip_offset[s], end = MIN(n, (s + 1)*strip_height*w);
+        for(int i = s*strip_height*w; i < end; ++i) {
+            if(root[i] == i) parent[i] = ++label;
+        }
+    }
+    #pragma omp parallel for
+    for(int i = 0; i < n; ++i) {
+        root[i] = root[i] >= 0 ? parent[root[i]] : 0;
+    }
+
+    cc_label* out_labels = NULL;
+    if(num_labels > 0) {
+        cc_label empty = { w, -1, h, -1, 0, 0, 0.f, 0.f, 0.0, 0.0 };
+        cc_label* l = sb_add(out_labels, num_labels);
+        for(int i = 0; i < num_labels; ++i) {
+            l[i] = empty;
+            l[i].label = i + 1;
+        }
+    }
+    for(int y = 0; y < h; ++y) {
+        for(int x = 0; x < w; ++x) {
+            int label = root[y*w + x];
+            if(!label) continue;
+            cc_label* l = &out_labels[label - 1];
+            l->xmin = MIN(l->xmin, x), l->xmax = MAX(l->xmax, x);
+            l->ymin = MIN(l->ymin, y), l->ymax = MAX(l->ymax, y);
+            l->area++;
+            l->m10 += x, l->m01 += y;
+        }
+    }
+    for(int i = 0; i < num_labels; ++i) {
+        out_labels[i].cx = out_labels[i].m10 / out_labels[i].area;
+        out_labels[i].cy = out_labels[i].m01 / out_labels[i].area;
+    }
+
+    if(label_map) {
+        *label_map = make_image(w, h, 1);
+        #pragma omp parallel for
+        for(int i = 0; i < n; ++i) label_map->data[i] = (float)root[i];
+    }
+    free(parent);
+    free(root);
+    free(strip_offset);
     return out_labels;
 }
 
-box* detect_blobs(image m, int* num_boxes, int(*box_filter)(int width, int height))
+cc_label* cc_label_image(image m)
 {
-    if (!m.data || m.c != 1) {
-        if (num_boxes) *num_boxes = 0;
-        return 0;
+    cc_label* labels = connected_components(m, 8, NULL);
+    for(int i = 0; i < sb_count(labels); ++i) labels[i].label--;
+    return labels;
+}
+
+cc_label* rle_connected_components(rle_image r, int connectivity, int** run_labels)
+{
+    int* parent = malloc((r.n ? r.n : 1)*sizeof(int));
+    for(int i = 0; i < r.n; ++i) parent[i] = i;
+    // with 8-connectivity, runs also touch when they only meet diagonally
+    int reach = connectivity == 4 ? 0 : 1;
+    for(int y = 1; y < r.h; ++y) {
+        int i = r.row_start[y], j = r.row_start[y - 1];
+        int i_end = r.row_start[y + 1], j_end = r.row_start[y];
+        while(i < i_end && j < j_end) {
+            run a = r.runs[i], b = r.runs[j];
+            if(a.xs < b.xe + reach && b.xs < a.xe + reach) cc_union(parent, i, j);
+            if(a.xe < b.xe) ++i;
+            else ++j;
+        }
+    }
+
+    // roots are the first run of their component, so labels come out in raster order
+    int num_labels = 0;
+    int* labels = malloc((r.n ? r.n : 1)*sizeof(int));
+    for(int i = 0; i < r.n; ++i) {
+        int root = cc_find(parent, i);
+        labels[i] = root == i ? ++num_labels : labels[root];
+    }
+    free(parent);
+    cc_label* out_labels = NULL;
+    if(num_labels > 0) {
+        cc_label empty = { r.w, -1, r.h, -1, 0, 0, 0.f, 0.f, 0.0, 0.0 };
+        cc_label* l = sb_add(out_labels, num_labels);
+        for(int i = 0; i < num_labels; ++i) {
+            l[i] = empty;
+            l[i].label = i + 1;
+        }
+    }
+    for(int y = 0; y < r.h; ++y) {
+        for(int i = r.row_start[y]; i < r.row_start[y + 1]; ++i) {
+            int label = labels[i];
+            run a = r.runs[i];
+            int len = a.xe - a.xs;
+            cc_label* l = &out_labels[label - 1];
+            l->xmin = MIN(l->xmin, a.xs), l->xmax = MAX(l->xmax, a.xe - 1);
+            l->ymin = MIN(l->ymin, y), l->ymax = MAX(l->ymax, y);
+            l->area += len;
+            l->m10 += 0.5*(a.xs + a.xe - 1)*len;
+            l->m01 += (double)y*len;
+        }
+    }
+    for(int i = 0; i < num_labels; ++i) {
+        out_labels[i].cx = out_labels[i].m10 / out_labels[i].area;
+        out_labels[i].cy = out_labels[i].m01 / out_labels[i].area;
     }
-    cc_label* labels = cc_label_image(m);
+    if(run_labels) *run_labels = labels;
+    else free(labels);
+    return out_labels;
+}
+
+static box* boxes_from_labels(cc_label* labels, int* num_boxes, int(*box_filter)(int width, int height))
+{
     int num_labels = (int)sb_count(labels);
 
-    box detection;
+    // the filter is cheap compared to labeling, a serial pass keeps the boxes in label order
     box* out_boxes = NULL;
-    #pragma omp parallel for schedule(dynamic) private(detection)
     for(int i = 0; i < num_labels; ++i) {
         cc_label label = labels[i];
-        if(label.label == -1) continue;
-        int allow = 1;
         int h = label.ymax - label.ymin, w = label.xmax - label.xmin;
-        if(box_filter) {
-            allow = box_filter(w, h);
-        }
-        if(allow) {
-            detection.score = 0;
-            detection.name = "blob";
-            detection.x = label.xmin, detection.y = label.ymin;
-            detection.w = w, detection.h = h;
-            #pragma omp critical
-            sb_push(out_boxes, detection);
-        }
+        if(box_filter && !box_filter(w, h)) continue;
+        box detection;
+        detection.score = label.area;
+        detection.name = "blob";
+        detection.x = label.xmin, detection.y = label.ymin;
+        detection.w = w, detection.h = h;
+        sb_push(out_boxes, detection);
+    }
+    *num_boxes = (int)sb_count(out_boxes);
+    return out_boxes;
+}
+
+box* detect_blobs(image m, int* num_boxes, int(*box_filter)(int width, int height))
+{
+    if (!m.data || m.c != 1) {
+        if (num_boxes) *num_boxes = 0;
+        return 0;
     }
+    cc_label* labels = connected_components(m, 8, NULL);
+    box* out_boxes = boxes_from_labels(labels, num_boxes, box_filter);
     sb_free(labels);
+    return out_boxes;
+}
 
-    *num_boxes = (int)sb_count(out_boxes);
+box* detect_blobs_rle(rle_image r, int* num_boxes, int(*box_filter)(int width, int height))
+{
+    cc_label* labels = rle_connected_components(r, 8, NULL);
+    box* out_boxes = boxes_from_labels(labels, num_boxes, box_filter);
+    sb_free(labels);
     return out_boxes;
 }
 
@@ -93,3 +245,8 @@ void draw_blob_detections(image* m, box* detections, int num_detections)
         draw_bbox_width(m, detections[i], 8, 0, 191, 255);
     }
 }
+
+void free_blobs(box* detections)
+{
+    sb_free(detections);
+}
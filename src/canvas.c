@@ -0,0 +1,453 @@
+#include "canvas.h"
+
+#include "utils.h"
+#include "stb_image_write.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define CANVAS_MIN_BUDGET 4
+#define DEFLATE_WINDOW 32768 // farthest back a deflate match may point
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_CHAIN 16 // most earlier positions compared for a match
+
+static inline size_t tile_bytes(const canvas* cv)
+{
+    return (size_t)CANVAS_TILE*CANVAS_TILE*cv->c*sizeof(float);
+}
+
+canvas make_canvas(int w, int h, int c, size_t memory)
+{
+    canvas cv = {0};
+    cv.w = w, cv.h = h, cv.c = c;
+    cv.cols = (w + CANVAS_TILE - 1) / CANVAS_TILE;
+    cv.rows = (h + CANVAS_TILE - 1) / CANVAS_TILE;
+    cv.budget = MAX(CANVAS_MIN_BUDGET, memory / tile_bytes(&cv));
+    size_t n = (size_t)cv.cols*cv.rows;
+    cv.tile = calloc(n, sizeof(float*));
+    cv.pins = calloc(n, sizeof(int));
+    cv.spilled = calloc(n, 1);
+    cv.last_use = calloc(n, sizeof(unsigned long));
+    cv.fd = -1;
+    return cv;
+}
+
+void free_canvas(canvas* cv)
+{
+    size_t n = (size_t)cv->cols*cv->rows;
+    for(size_t i = 0; i < n; ++i) free(cv->tile[i]);
+    free(cv->tile); free(cv->pins); free(cv->spilled); free(cv->last_use);
+    if(cv->scratch) munmap(cv->scratch, cv->scratch_size);
+    if(cv->fd >= 0) close(cv->fd);
+    cv->tile = NULL;
+    cv->scratch = NULL;
+    cv->fd = -1;
+}
+
+// maps a sparse scratch file with a slot for every tile, so that spilling is a copy
+static int open_scratch(canvas* cv)
+{
+    if(cv->scratch) return 1;
+    const char* dir = getenv("TMPDIR");
+    char path[512];
+    snprintf(path, sizeof(path), "%s/boomercv-canvas-XXXXXX", dir ? dir : "/tmp");
+    cv->fd = mkstemp(path);
+    if(cv->fd < 0) return 0;
+    unlink(path);
+    cv->scratch_size = (size_t)cv->cols*cv->rows*tile_bytes(cv);
+    if(ftruncate(cv->fd, cv->scratch_size) != 0) return 0;
+    void* map = mmap(NULL, cv->scratch_size, PROT_READ | PROT_WRITE, MAP_SHARED, cv->fd, 0);
+    if(map == MAP_FAILED) return 0;
+    cv->scratch = map;
+    return 1;
+}
+
+// spills the least recently used unpinned tile and returns its buffer, NULL if there is none
+static float* evict_tile(canvas* cv)
+{
+    size_t n = (size_t)cv->cols*cv->rows, victim = n;
+    for(size_t i = 0; i < n; ++i) {
+        if(!cv->tile[i] || cv->pins[i]) continue;
+        if(victim == n || cv->last_use[i] < cv->last_use[victim]) victim = i;
+    }
+    if(victim == n) return NULL;
+    if(!open_scratch(cv)) {
+        fprintf(stderr, "canvas: no scratch file, keeping all tiles in memory\n");
+        cv->budget = n;
+        return NULL;
+    }
+    float* data = cv->tile[victim];
+    memcpy(cv->scratch + victim*tile_bytes(cv), data, tile_bytes(cv));
+    cv->spilled[victim] = 1;
+    cv->tile[victim] = NULL;
+    return data;
+}
+
+image acquire_canvas_tile(canvas* cv, int tx, int ty, int create)
+{
+    image t = {0};
+    t.w = t.h = CANVAS_TILE, t.c = cv->c;
+    size_t i = (size_t)ty*cv->cols + tx;
+    const size_t bytes = tile_bytes(cv);
+    #pragma omp critical(canvas)
+    {
+        if(!cv->tile[i] && (create || cv->spilled[i])) {
+            float* data = cv->resident >= cv->budget ? evict_tile(cv) : NULL;
+            if(!data) {
+                data = malloc(bytes);
+                cv->resident++;
+            }
+            if(cv->spilled[i]) memcpy(data, cv->scratch + i*bytes, bytes);
+            else memset(data, 0, bytes);
+            cv->tile[i] = data;
+        }
+        if(cv->tile[i]) {
+            cv->pins[i]++;
+            cv->last_use[i] = ++cv->clock;
+        }
+        t.data = cv->tile[i];
+    }
+    return t;
+}
+
+void release_canvas_tile(canvas* cv, int tx, int ty)
+{
+    size_t i = (size_t)ty*cv->cols + tx;
+    #pragma omp critical(canvas)
+    if(cv->tile[i] && cv->pins[i] > 0) cv->pins[i]--;
+}
+
+rect canvas_tile_rect(canvas* cv, int tx, int ty)
+{
+    rect r = { tx*CANVAS_TILE, ty*CANVAS_TILE, 0, 0 };
+    r.w = MIN(CANVAS_TILE, cv->w - r.x), r.h = MIN(CANVAS_TILE, cv->h - r.y);
+    return r;
+}
+
+void warp_canvas(image src, hom3 H, canvas* cv, rect roi)
+{
+    int tx0 = MAX(0, roi.x / CANVAS_TILE), ty0 = MAX(0, roi.y / CANVAS_TILE);
+    int tx1 = MIN(cv->cols, (roi.x + roi.w + CANVAS_TILE - 1) / CANVAS_TILE);
+    int ty1 = MIN(cv->rows, (roi.y + roi.h + CANVAS_TILE - 1) / CANVAS_TILE);
+    int* tiles = NULL;
+    int n = 0;
+    if(tx1 > tx0 && ty1 > ty0) tiles = malloc((size_t)(tx1 - tx0)*(ty1 - ty0)*sizeof(int));
+    for(int ty = ty0; ty < ty1; ++ty) {
+        for(int tx = tx0; tx < tx1; ++tx) {
+            if(warp_reaches(src, H, canvas_tile_rect(cv, tx, ty))) tiles[n++] = ty*cv->cols + tx;
+        }
+    }
+    #pragma omp parallel for schedule(dynamic)
+    for(int i = 0; i < n; ++i) {
+        int tx = tiles[i] % cv->cols, ty = tiles[i] / cv->cols;
+        rect r = canvas_tile_rect(cv, tx, ty);
+        // the part of roi in this tile, in tile coordinates
+        rect local = { MAX(roi.x, r.x) - r.x, MAX(roi.y, r.y) - r.y, 0, 0 };
+        local.w = MIN(roi.x + roi.w, r.x + r.w) - r.x - local.x;
+        local.h = MIN(roi.y + roi.h, r.y + r.h) - r.y - local.y;
+        if(local.w <= 0 || local.h <= 0) continue;
+        image t = acquire_canvas_tile(cv, tx, ty, 1);
+        warp_perspective(src, hom3_multiply(H, hom3_translation(r.x, r.y)), t, local);
+        release_canvas_tile(cv, tx, ty);
+    }
+    free(tiles);
+}
+
+// converts the rows of tile band ty to interleaved bytes, stride bytes apart starting at out + skip
+static void canvas_band_bytes(canvas* cv, int ty, unsigned char* out, size_t stride, size_t skip)
+{
+    #pragma omp parallel for schedule(dynamic)
+    for(int tx = 0; tx < cv->cols; ++tx) {
+        rect r = canvas_tile_rect(cv, tx, ty);
+        image t = acquire_canvas_tile(cv, tx, ty, 0);
+        for(int y = 0; y < r.h; ++y) {
+            unsigned char* row = out + y*stride + skip + (size_t)r.x*cv->c;
+            for(int x = 0; x < r.w; ++x) {
+                for(int k = 0; k < cv->c; ++k) {
+                    float v = t.data ? t.data[(size_t)k*CANVAS_TILE*CANVAS_TILE + y*CANVAS_TILE + x] : 0;
+                    row[x*cv->c + k] = (unsigned char)(255*fminf(fmaxf(v, 0), 1));
+                }
+            }
+        }
+        if(t.data) release_canvas_tile(cv, tx, ty);
+    }
+}
+
+static uint32_t crc_table[256];
+static uint16_t literal_code[288]; // fixed huffman codes of deflate, bit reversed to be written lsb first
+static unsigned char literal_bits[288];
+
+static const int length_base[30] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+                                     67, 83, 99, 115, 131, 163, 195, 227, 258, 259 };
+static const int length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const int dist_base[31] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025,
+                                   1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577, 32769 };
+static const int dist_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static inline uint32_t reverse_bits(uint32_t v, int n)
+{
+    uint32_t r = 0;
+    for(int i = 0; i < n; ++i) r = r << 1 | (v >> i & 1);
+    return r;
+}
+
+static void init_png_tables(void)
+{
+    for(uint32_t n = 0; n < 256; ++n) {
+        uint32_t c = n;
+        for(int k = 0; k < 8; ++k) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+    for(int c = 0; c < 288; ++c) {
+        int code, bits;
+        if(c < 144) code = 0x30 + c, bits = 8;
+        else if(c < 256) code = 0x190 + c - 144, bits = 9;
+        else if(c < 280) code = c - 256, bits = 7;
+        else code = 0xc0 + c - 280, bits = 8;
+        literal_code[c] = reverse_bits(code, bits);
+        literal_bits[c] = bits;
+    }
+}
+
+static uint32_t update_crc(uint32_t crc, const unsigned char* p, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) crc = crc_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static uint32_t update_adler(uint32_t adler, const unsigned char* p, size_t n)
+{
+    uint32_t a = adler & 0xffff, b = adler >> 16;
+    while(n > 0) {
+        size_t run = MIN(n, 5552); // the most bytes before the sums can overflow
+        for(size_t i = 0; i < run; ++i) a += p[i], b += a;
+        a %= 65521, b %= 65521;
+        p += run, n -= run;
+    }
+    return b << 16 | a;
+}
+
+static inline void put_be32(unsigned char* p, uint32_t v)
+{
+    p[0] = v >> 24, p[1] = v >> 16, p[2] = v >> 8, p[3] = v;
+}
+
+// deflate output. The bits of an unfinished byte carry over to the next band
+typedef struct {
+    unsigned char* data;
+    size_t n;
+    uint32_t bits;
+    int count;
+} bit_writer;
+
+static inline void put_bits(bit_writer* w, uint32_t v, int n)
+{
+    w->bits |= v << w->count;
+    w->count += n;
+    while(w->count >= 8) {
+        w->data[w->n++] = w->bits & 0xff;
+        w->bits >>= 8;
+        w->count -= 8;
+    }
+}
+
+static inline void put_literal(bit_writer* w, int c)
+{
+    put_bits(w, literal_code[c], literal_bits[c]);
+}
+
+static void put_match(bit_writer* w, int len, int dist)
+{
+    int i = 0, j = 0;
+    while(length_base[i + 1] <= len) ++i;
+    while(dist_base[j + 1] <= dist) ++j;
+    put_literal(w, 257 + i);
+    put_bits(w, len - length_base[i], length_extra[i]);
+    put_bits(w, reverse_bits(j, 5), 5);
+    put_bits(w, dist - dist_base[j], dist_extra[j]);
+}
+
+static inline uint32_t hash3(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 16 | p[1] << 8 | p[2])*2654435761u >> (32 - DEFLATE_HASH_BITS);
+}
+
+// LZ77 over hash chains with the fixed huffman codes, matches stay within the band.
+// ptrdiff_t* head: 1 << DEFLATE_HASH_BITS entries, ptrdiff_t* prev: DEFLATE_WINDOW entries.
+static void deflate_band(bit_writer* w, const unsigned char* p, size_t n, ptrdiff_t* head, ptrdiff_t* prev)
+{
+    for(int i = 0; i < 1 << DEFLATE_HASH_BITS; ++i) head[i] = -1;
+    size_t i = 0, inserted = 0;
+    while(i < n) {
+        int best = 0;
+        ptrdiff_t best_dist = 0;
+        if(i + 3 <= n) {
+            const int longest = (int)MIN(258, n - i);
+            ptrdiff_t c = head[hash3(p + i)];
+            for(int k = 0; k < DEFLATE_CHAIN && c >= 0 && (ptrdiff_t)i - c <= DEFLATE_WINDOW; ++k) {
+                int len = 0;
+                while(len < longest && p[c + len] == p[i + len]) ++len;
+                if(len > best) {
+                    best = len, best_dist = i - c;
+                    if(len == longest) break;
+                }
+                c = prev[c & (DEFLATE_WINDOW - 1)];
+            }
+        }
+        if(best >= 3) put_match(w, best, (int)best_dist);
+        else put_literal(w, p[i]), best = 1;
+        i += best;
+        for(; inserted < i && inserted + 3 <= n; ++inserted) {
+            uint32_t h = hash3(p + inserted);
+            prev[inserted & (DEFLATE_WINDOW - 1)] = head[h];
+            head[h] = inserted;
+        }
+    }
+}
+
+static inline int paeth(int a, int b, int c)
+{
+    int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if(pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+// Filters a scanline of len bytes with the PNG filter whose output has the smallest sum of
+// absolute values, into the filter type byte and len bytes at out.
+static void filter_row(const unsigned char* row, const unsigned char* above, int len, int bpp, unsigned char* out)
+{
+    int sum[5] = {0};
+    for(int x = 0; x < len; ++x) {
+        int a = x >= bpp ? row[x - bpp] : 0, b = above[x], c = x >= bpp ? above[x - bpp] : 0;
+        sum[0] += abs((signed char)row[x]);
+        sum[1] += abs((signed char)(row[x] - a));
+        sum[2] += abs((signed char)(row[x] - b));
+        sum[3] += abs((signed char)(row[x] - (a + b)/2));
+        sum[4] += abs((signed char)(row[x] - paeth(a, b, c)));
+    }
+    int f = 0;
+    for(int k = 1; k < 5; ++k) if(sum[k] < sum[f]) f = k;
+    out[0] = f;
+    for(int x = 0; x < len; ++x) {
+        int a = x >= bpp ? row[x - bpp] : 0, b = above[x], c = x >= bpp ? above[x - bpp] : 0;
+        int pred = f == 0 ? 0 : f == 1 ? a : f == 2 ? b : f == 3 ? (a + b)/2 : paeth(a, b, c);
+        out[1 + x] = row[x] - pred;
+    }
+}
+
+// writes a chunk from pieces, so that large chunks need no copy
+static void write_png_chunk(FILE* f, const char* type, const unsigned char** data, const size_t* len, int pieces)
+{
+    unsigned char head[8];
+    size_t total = 0;
+    for(int i = 0; i < pieces; ++i) total += len[i];
+    put_be32(head, (uint32_t)total);
+    memcpy(head + 4, type, 4);
+    fwrite(head, 1, 8, f);
+    uint32_t crc = update_crc(0xffffffffu, head + 4, 4);
+    for(int i = 0; i < pieces; ++i) {
+        fwrite(data[i], 1, len[i], f);
+        crc = update_crc(crc, data[i], len[i]);
+    }
+    unsigned char tail[4];
+    put_be32(tail, crc ^ 0xffffffffu);
+    fwrite(tail, 1, 4, f);
+}
+
+int save_canvas_png(canvas* cv, const char* filename)
+{
+    static const unsigned char color_type[5] = { 0, 0, 4, 2, 6 };
+    char path[256];
+    snprintf(path, sizeof(path), "%s.png", filename);
+    if(cv->c < 1 || cv->c > 4) return 0;
+    FILE* f = fopen(path, "wb");
+    if(!f) {
+        fprintf(stderr, "Failed to write image %s\n", path);
+        return 0;
+    }
+    init_png_tables();
+    static const unsigned char signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    fwrite(signature, 1, 8, f);
+    unsigned char ihdr[13] = {0};
+    put_be32(ihdr, cv->w);
+    put_be32(ihdr + 4, cv->h);
+    ihdr[8] = 8, ihdr[9] = color_type[cv->c];
+    const unsigned char* piece[1] = { ihdr };
+    size_t len[1] = { 13 };
+    write_png_chunk(f, "IHDR", piece, len, 1);
+
+    // One zlib stream over all bands: a fixed huffman block that every band extends, so each band
+    // is filtered, compressed and written before the next one is read.
+    const size_t bytes = (size_t)cv->w*cv->c, stride = 1 + bytes;
+    unsigned char* band = malloc(CANVAS_TILE*bytes);
+    unsigned char* above = calloc(bytes, 1);
+    unsigned char* filtered = malloc(CANVAS_TILE*stride);
+    ptrdiff_t* head = malloc(((size_t)1 << DEFLATE_HASH_BITS)*sizeof(ptrdiff_t));
+    ptrdiff_t* prev = malloc(DEFLATE_WINDOW*sizeof(ptrdiff_t));
+    // fixed huffman codes take at most 9 bits a byte
+    bit_writer w = {0};
+    w.data = malloc(CANVAS_TILE*stride + CANVAS_TILE*stride/8 + 16);
+    w.data[w.n++] = 0x78, w.data[w.n++] = 0x01;
+    put_bits(&w, 0, 1);
+    put_bits(&w, 1, 2);
+    uint32_t adler = 1;
+    for(int ty = 0; ty < cv->rows; ++ty) {
+        int rows = MIN(CANVAS_TILE, cv->h - ty*CANVAS_TILE);
+        canvas_band_bytes(cv, ty, band, bytes, 0);
+        for(int y = 0; y < rows; ++y) {
+            filter_row(band + y*bytes, y ? band + (y - 1)*bytes : above, bytes, cv->c, filtered + y*stride);
+        }
+        memcpy(above, band + (rows - 1)*bytes, bytes);
+        size_t n = rows*stride;
+        adler = update_adler(adler, filtered, n);
+        deflate_band(&w, filtered, n, head, prev);
+        piece[0] = w.data, len[0] = w.n;
+        write_png_chunk(f, "IDAT", piece, len, 1);
+        w.n = 0;
+    }
+    // end the block, then an empty final block ends the deflate stream and the adler checksum ends zlib
+    put_literal(&w, 256);
+    put_bits(&w, 1, 1);
+    put_bits(&w, 1, 2);
+    put_literal(&w, 256);
+    if(w.count) put_bits(&w, 0, 8 - w.count);
+    put_be32(w.data + w.n, adler);
+    piece[0] = w.data, len[0] = w.n + 4;
+    write_png_chunk(f, "IDAT", piece, len, 1);
+    write_png_chunk(f, "IEND", piece, len, 0);
+    free(band); free(above); free(filtered); free(head); free(prev); free(w.data);
+    int ok = !ferror(f);
+    if(fclose(f) != 0) ok = 0;
+    if(!ok) fprintf(stderr, "Failed to write image %s\n", path);
+    return ok;
+}
+
+int save_canvas_jpg(canvas* cv, const char* filename, int quality)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s.jpg", filename);
+    if(cv->w > 65535 || cv->h > 65535) {
+        fprintf(stderr, "Failed to write image %s, too large for JPEG\n", path);
+        return 0;
+    }
+    const size_t stride = (size_t)cv->w*cv->c;
+    if(stride*cv->h > cv->budget*tile_bytes(cv)) {
+        fprintf(stderr, "Failed to write image %s, JPEG needs %zu MB at once, more than the canvas memory\n",
+                path, (stride*cv->h) >> 20);
+        return 0;
+    }
+    unsigned char* pixels = malloc(stride*cv->h);
+    for(int ty = 0; ty < cv->rows; ++ty) {
+        canvas_band_bytes(cv, ty, pixels + (size_t)ty*CANVAS_TILE*stride, stride, 0);
+    }
+    int success = stbi_write_jpg(path, cv->w, cv->h, cv->c, pixels, quality);
+    if(!success) fprintf(stderr, "Failed to write image %s\n", path);
+    free(pixels);
+    return success;
+}
@@ -0,0 +1,271 @@
+#include "descriptor.h"
+
+#include "utils.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#define DESCRIPTOR_ALIGN 32
+#define NEAREST_A_BLOCK 32  // rows of a matched against one tile of b at a time
+#define NEAREST_B_TILE 64   // rows of b per tile, small enough to stay in L1
+
+descriptor_set make_descriptor_set(int n, int d)
+{
+    descriptor_set s = {0};
+    s.type = FLOAT_DESCRIPTOR;
+    s.n = n, s.d = d;
+    s.stride = (d + 7) & ~7;
+    s.p = calloc(n ? n : 1, sizeof(point));
+    s.score = calloc(n ? n : 1, sizeof(float));
+    s.level = calloc(n ? n : 1, sizeof(int));
+    s.data = aligned_calloc(DESCRIPTOR_ALIGN, (size_t)n*s.stride*sizeof(float));
+    return s;
+}
+
+descriptor_set make_binary_descriptor_set(int n, int bits)
+{
+    descriptor_set s = {0};
+    s.type = BINARY_DESCRIPTOR;
+    s.n = n, s.d = bits;
+    s.stride = (bits + 63) / 64;
+    s.p = calloc(n ? n : 1, sizeof(point));
+    s.score = calloc(n ? n : 1, sizeof(float));
+    s.level = calloc(n ? n : 1, sizeof(int));
+    s.bits = aligned_calloc(DESCRIPTOR_ALIGN, (size_t)n*s.stride*sizeof(uint64_t));
+    return s;
+}
+
+void free_descriptor_set(descriptor_set* s)
+{
+    free(s->p);
+    free(s->score);
+    free(s->level);
+    free(s->data);
+    free(s->bits);
+    s->p = NULL, s->score = NULL, s->level = NULL, s->data = NULL, s->bits = NULL;
+    s->n = 0;
+}
+
+descriptor_set concat_descriptor_sets(const descriptor_set* s, int n)
+{
+    int total = 0;
+    for(int i = 0; i < n; ++i) total += s[i].n;
+    descriptor_set out = s[0].type == BINARY_DESCRIPTOR ? make_binary_descriptor_set(total, s[0].d)
+                                                        : make_descriptor_set(total, s[0].d);
+    for(int i = 0, first = 0; i < n; first += s[i].n, ++i) {
+        if(s[i].type == BINARY_DESCRIPTOR) {
+            memcpy(descriptor_bits(out, first), s[i].bits, (size_t)s[i].n*s[i].stride*sizeof(uint64_t));
+        }
+        else {
+            memcpy(descriptor_row(out, first), s[i].data, (size_t)s[i].n*s[i].stride*sizeof(float));
+        }
+        memcpy(out.p + first, s[i].p, s[i].n*sizeof(point));
+        memcpy(out.score + first, s[i].score, s[i].n*sizeof(float));
+        memcpy(out.level + first, s[i].level, s[i].n*sizeof(int));
+    }
+    return out;
+}
+
+descriptor_set describe_patches(image m, const point* p, const float* score, int n)
+{
+    const int w = 5, r = w/2;
+    descriptor_set s = make_descriptor_set(n, w*w*m.c);
+    memcpy(s.p, p, n*sizeof(point));
+    if(score) memcpy(s.score, score, n*sizeof(float));
+
+    #pragma omp parallel for
+    for(int i = 0; i < n; ++i) {
+        int x = (int)lrintf(p[i].x), y = (int)lrintf(p[i].y);
+        float* d = descriptor_row(s, i);
+        int inside = x - r >= 0 && x + r < m.w && y - r >= 0 && y + r < m.h;
+        // subtracts the central value from neighbors to compensate some for exposure/lighting changes
+        for(int c = 0; c < m.c; ++c) {
+            const float* plane = m.data + c*m.w*m.h;
+            float central_val = plane[y*m.w + x];
+            float* out = d + c*w*w;
+            if(inside) {
+                for(int dx = -r; dx <= r; ++dx) {
+                    const float* col = plane + (y - r)*m.w + x + dx;
+                    #pragma omp simd
+                    for(int dy = 0; dy < w; ++dy) {
+                        out[(dx + r)*w + dy] = central_val - col[dy*m.w];
+                    }
+                }
+            }
+            else {
+                for(int dx = -r; dx <= r; ++dx) {
+                    for(int dy = -r; dy <= r; ++dy) {
+                        out[(dx + r)*w + dy + r] = central_val - get_pixel(m, x + dx, y + dy, c);
+                    }
+                }
+            }
+        }
+    }
+    return s;
+}
+
+static inline void keep_nearest(nearest_pair* nn, int i, float dist)
+{
+    if(dist < nn->best_dist) {
+        nn->second = nn->best, nn->second_dist = nn->best_dist;
+        nn->best = i, nn->best_dist = dist;
+    }
+    else if(dist < nn->second_dist) {
+        nn->second = i, nn->second_dist = dist;
+    }
+}
+
+// L1 or squared L2 distance between two descriptor rows, including the zero padding.
+static inline float row_distance(const float* a, const float* b, int stride, int l2)
+{
+    float dist = 0;
+    if(l2) {
+        #pragma omp simd reduction(+:dist)
+        for(int k = 0; k < stride; ++k) dist += (a[k] - b[k])*(a[k] - b[k]);
+    }
+    else {
+        #pragma omp simd reduction(+:dist)
+        for(int k = 0; k < stride; ++k) dist += fabsf(a[k] - b[k]);
+    }
+    return dist;
+}
+
+float descriptor_distance(const float* a, const float* b, int stride, distance_metric metric)
+{
+    return row_distance(a, b, stride, metric == DISTANCE_L2);
+}
+
+#ifdef __AVX2__
+static inline __m256 distance_step(__m256 acc, __m256 a, __m256 b, int l2)
+{
+    __m256 d = _mm256_sub_ps(a, b);
+    // -mavx2 does not imply -mfma, builds with AVX2 alone square and add in two steps
+#ifdef __FMA__
+    if(l2) return _mm256_fmadd_ps(d, d, acc);
+#else
+    if(l2) return _mm256_add_ps(acc, _mm256_mul_ps(d, d));
+#endif
+    return _mm256_add_ps(acc, _mm256_andnot_ps(_mm256_set1_ps(-0.f), d));
+}
+
+// horizontal sums of four vectors
+static inline __m128 hsum4(__m256 a, __m256 b, __m256 c, __m256 d)
+{
+    __m256 s = _mm256_hadd_ps(_mm256_hadd_ps(a, b), _mm256_hadd_ps(c, d));
+    return _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+}
+
+// distances from two rows of a to four consecutive rows of b, eight floats at a time.
+static inline void distance_2x4(const float* a0, const float* a1, const float* b, int stride, int l2, float* d0, float* d1)
+{
+    const float *b0 = b, *b1 = b + stride, *b2 = b + 2*stride, *b3 = b + 3*stride;
+    __m256 s00 = _mm256_setzero_ps(), s01 = s00, s02 = s00, s03 = s00;
+    __m256 s10 = s00, s11 = s00, s12 = s00, s13 = s00;
+    for(int k = 0; k < stride; k += 8) {
+        __m256 x0 = _mm256_load_ps(a0 + k), x1 = _mm256_load_ps(a1 + k);
+        __m256 y = _mm256_load_ps(b0 + k);
+        s00 = distance_step(s00, x0, y, l2), s10 = distance_step(s10, x1, y, l2);
+        y = _mm256_load_ps(b1 + k);
+        s01 = distance_step(s01, x0, y, l2), s11 = distance_step(s11, x1, y, l2);
+        y = _mm256_load_ps(b2 + k);
+        s02 = distance_step(s02, x0, y, l2), s12 = distance_step(s12, x1, y, l2);
+        y = _mm256_load_ps(b3 + k);
+        s03 = distance_step(s03, x0, y, l2), s13 = distance_step(s13, x1, y, l2);
+    }
+    _mm_storeu_ps(d0, hsum4(s00, s01, s02, s03));
+    _mm_storeu_ps(d1, hsum4(s10, s11, s12, s13));
+}
+#else
+static inline void distance_2x4(const float* a0, const float* a1, const float* b, int stride, int l2, float* d0, float* d1)
+{
+    for(int t = 0; t < 4; ++t) {
+        d0[t] = row_distance(a0, b + t*stride, stride, l2);
+        d1[t] = row_distance(a1, b + t*stride, stride, l2);
+    }
+}
+#endif
+
+// Updates the nearest pairs of rows [a0, a1) of a with the rows [b0, b1) of b.
+static inline void nearest_tile(descriptor_set a, int a0, int a1, descriptor_set b, int b0, int b1, int l2, nearest_pair* nn)
+{
+    const int stride = a.stride;
+    int i = a0;
+    for(; i + 2 <= a1; i += 2) {
+        const float *x0 = descriptor_row(a, i), *x1 = descriptor_row(a, i + 1);
+        int j = b0;
+        for(; j + 4 <= b1; j += 4) {
+            float d0[4], d1[4];
+            distance_2x4(x0, x1, descriptor_row(b, j), stride, l2, d0, d1);
+            for(int t = 0; t < 4; ++t) {
+                keep_nearest(nn + i, j + t, d0[t]);
+                keep_nearest(nn + i + 1, j + t, d1[t]);
+            }
+        }
+        for(; j < b1; ++j) {
+            const float* y = descriptor_row(b, j);
+            keep_nearest(nn + i, j, row_distance(x0, y, stride, l2));
+            keep_nearest(nn + i + 1, j, row_distance(x1, y, stride, l2));
+        }
+    }
+    for(; i < a1; ++i) {
+        const float* x = descriptor_row(a, i);
+        for(int j = b0; j < b1; ++j) {
+            keep_nearest(nn + i, j, row_distance(x, descriptor_row(b, j), stride, l2));
+        }
+    }
+}
+
+// hamming distances from rows [a0, a1) of a to the rows [b0, b1) of b.
+static inline void nearest_bits_tile(descriptor_set a, int a0, int a1, descriptor_set b, int b0, int b1, nearest_pair* nn)
+{
+    const int words = a.stride;
+    for(int i = a0; i < a1; ++i) {
+        const uint64_t* x = descriptor_bits(a, i);
+        if(words == 4) {
+            // 256 bit descriptors, four xor and popcount per pair
+            for(int j = b0; j < b1; ++j) {
+                const uint64_t* y = descriptor_bits(b, j);
+                int dist = popcount64(x[0] ^ y[0]) + popcount64(x[1] ^ y[1]) +
+                           popcount64(x[2] ^ y[2]) + popcount64(x[3] ^ y[3]);
+                keep_nearest(nn + i, j, dist);
+            }
+        }
+        else {
+            for(int j = b0; j < b1; ++j) {
+                keep_nearest(nn + i, j, hamming_distance(x, descriptor_bits(b, j), words));
+            }
+        }
+    }
+}
+
+void nearest_descriptors(descriptor_set a, descriptor_set b, distance_metric metric, nearest_pair* nn)
+{
+    assert(a.type == b.type && a.stride == b.stride);
+    const int l2 = metric == DISTANCE_L2 && a.type == FLOAT_DESCRIPTOR;
+    #pragma omp parallel for schedule(dynamic)
+    for(int a0 = 0; a0 < a.n; a0 += NEAREST_A_BLOCK) {
+        int a1 = MIN(a0 + NEAREST_A_BLOCK, a.n);
+        for(int i = a0; i < a1; ++i) {
+            nearest_pair empty = {-1, -1, FLT_MAX, FLT_MAX};
+            nn[i] = empty;
+        }
+        for(int b0 = 0; b0 < b.n; b0 += NEAREST_B_TILE) {
+            int b1 = MIN(b0 + NEAREST_B_TILE, b.n);
+            if(a.type == BINARY_DESCRIPTOR) nearest_bits_tile(a, a0, a1, b, b0, b1, nn);
+            else nearest_tile(a, a0, a1, b, b0, b1, l2, nn);
+        }
+        if(l2) {
+            for(int i = a0; i < a1; ++i) {
+                if(nn[i].best >= 0) nn[i].best_dist = sqrtf(nn[i].best_dist);
+                if(nn[i].second >= 0) nn[i].second_dist = sqrtf(nn[i].second_dist);
+            }
+        }
+    }
+}
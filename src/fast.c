@@ -0,0 +1,220 @@
+#include "fast.h"
+
+#include "keypoints.h"
+#include "utils.h"
+#include "stretchy_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// offsets of the bresenham circle of radius 3, clockwise from the top
+static const int circle_x[16] = { 0, 1, 2, 3, 3, 3, 2, 1, 0, -1, -2, -3, -3, -3, -2, -1 };
+static const int circle_y[16] = { -3, -3, -2, -1, 0, 1, 2, 3, 3, 3, 2, 1, 0, -1, -2, -3 };
+
+// 8 bit mean of the channels, the segment test compares 16 pixels per instruction on it.
+static uint8_t* gray_bytes(image m)
+{
+    uint8_t* g = malloc((size_t)m.w*m.h);
+    const float scale = 255.f / m.c;
+    #pragma omp parallel for
+    for(int y = 0; y < m.h; ++y) {
+        // sum the channels in chunks of the row, one plane at a time so the loops vectorize
+        for(int x0 = 0; x0 < m.w; x0 += 256) {
+            float sum[256];
+            int n = MIN(256, m.w - x0);
+            const float* row = m.data + y*m.w + x0;
+            for(int x = 0; x < n; ++x) sum[x] = row[x];
+            for(int c = 1; c < m.c; ++c) {
+                const float* plane = row + (size_t)c*m.w*m.h;
+                for(int x = 0; x < n; ++x) sum[x] += plane[x];
+            }
+            uint8_t* out = g + y*m.w + x0;
+            for(int x = 0; x < n; ++x) {
+                float v = sum[x]*scale + .5f;
+                v = v < 0 ? 0 : v > 255 ? 255 : v;
+                out[x] = (uint8_t)v;
+            }
+        }
+    }
+    return g;
+}
+
+// returns: the smallest difference along the best arc around p, 0 if it is no corner for thresh t.
+// The pixel passes the segment test for every t below the returned score.
+static int corner_score(const uint8_t* p, const int* offsets, int t, int arc)
+{
+    // the circle twice over, so that arcs wrapping around are contiguous, and the
+    // minimum and maximum difference over windows of 2, 4 and 8 pixels starting at every pixel
+    int d[32], lo2[32], hi2[32], lo4[32], hi4[32], lo8[16], hi8[16];
+    for(int k = 0; k < 16; ++k) d[k] = d[k + 16] = p[offsets[k]] - p[0];
+    for(int k = 0; k < 31; ++k) lo2[k] = MIN(d[k], d[k+1]), hi2[k] = MAX(d[k], d[k+1]);
+    for(int k = 0; k < 29; ++k) lo4[k] = MIN(lo2[k], lo2[k+2]), hi4[k] = MAX(hi2[k], hi2[k+2]);
+    for(int k = 0; k < 16; ++k) lo8[k] = MIN(lo4[k], lo4[k+4]), hi8[k] = MAX(hi4[k], hi4[k+4]);
+
+    int best = 0;
+    for(int s = 0; s < 16; ++s) {
+        // the remaining arc - 8 pixels after the first 8
+        int e = s + 8, lo, hi;
+        switch(arc - 8) {
+            case 1: lo = d[e], hi = d[e]; break;
+            case 2: lo = lo2[e], hi = hi2[e]; break;
+            case 3: lo = MIN(lo2[e], d[e+2]), hi = MAX(hi2[e], d[e+2]); break;
+            default: lo = lo4[e], hi = hi4[e]; break;
+        }
+        lo = MIN(lo, lo8[s]), hi = MAX(hi, hi8[s]);
+        // every pixel of the arc is brighter by lo, or darker by -hi
+        best = MAX(best, MAX(lo, -hi));
+    }
+    return best > t ? best : 0;
+}
+
+// scores the pixels x0 <= x < x1 of one row, for pixels at least 3 away from the border.
+static void score_row_scalar(const uint8_t* row, const int* offsets, int x0, int x1, int t, int arc, uint8_t* out)
+{
+    for(int x = x0; x < x1; ++x) {
+        const uint8_t* p = row + x;
+        int bright = 0, dark = 0, run_b = 0, run_d = 0;
+        for(int k = 0; k < 16 + arc - 1; ++k) {
+            int v = p[offsets[k & 15]];
+            run_b = v > p[0] + t ? run_b + 1 : 0;
+            run_d = v < p[0] - t ? run_d + 1 : 0;
+            bright = MAX(bright, run_b), dark = MAX(dark, run_d);
+        }
+        out[x] = bright >= arc || dark >= arc ? corner_score(p, offsets, t, arc) : 0;
+    }
+}
+
+#ifdef __SSE2__
+// segment test of 16 pixels at once, one byte lane per pixel. returns: the lanes that are corners.
+static inline int segment_test16(const uint8_t* p, const int* offsets, int t, int arc)
+{
+    const __m128i sign = _mm_set1_epi8((char)0x80), one = _mm_set1_epi8(1);
+    __m128i c = _mm_loadu_si128((const __m128i*)p);
+    __m128i hi = _mm_xor_si128(_mm_adds_epu8(c, _mm_set1_epi8((char)t)), sign);
+    __m128i lo = _mm_xor_si128(_mm_subs_epu8(c, _mm_set1_epi8((char)t)), sign);
+    __m128i bright[16], dark[16];
+
+    // an arc of 9 or more holds at least one pixel of every opposite pair on the circle,
+    // test the pairs coarse to fine and stop as soon as no lane can be a corner
+    static const int order[16] = { 0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 3, 11, 5, 13, 7, 15 };
+    __m128i any_b = _mm_set1_epi8(-1), any_d = any_b;
+    for(int i = 0; i < 16; i += 2) {
+        int k0 = order[i], k1 = order[i+1];
+        __m128i v0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(p + offsets[k0])), sign);
+        __m128i v1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(p + offsets[k1])), sign);
+        bright[k0] = _mm_cmpgt_epi8(v0, hi), bright[k1] = _mm_cmpgt_epi8(v1, hi);
+        dark[k0] = _mm_cmpgt_epi8(lo, v0), dark[k1] = _mm_cmpgt_epi8(lo, v1);
+        any_b = _mm_and_si128(any_b, _mm_or_si128(bright[k0], bright[k1]));
+        any_d = _mm_and_si128(any_d, _mm_or_si128(dark[k0], dark[k1]));
+        if((i == 2 || i == 6 || i == 14) && !_mm_movemask_epi8(_mm_or_si128(any_b, any_d))) return 0;
+    }
+    // longest run of brighter and of darker pixels, going around the circle once plus arc - 1
+    __m128i run_b = _mm_setzero_si128(), run_d = run_b, max_run = run_b;
+    for(int k = 0; k < 16 + arc - 1; ++k) {
+        run_b = _mm_and_si128(_mm_add_epi8(run_b, one), bright[k & 15]);
+        run_d = _mm_and_si128(_mm_add_epi8(run_d, one), dark[k & 15]);
+        max_run = _mm_max_epu8(max_run, _mm_max_epu8(run_b, run_d));
+    }
+    return _mm_movemask_epi8(_mm_cmpgt_epi8(max_run, _mm_set1_epi8((char)(arc - 1))));
+}
+#endif
+
+// score map of the whole image, 0 for pixels that are no corners.
+static uint8_t* fast_score_map(const uint8_t* g, int w, int h, int t, int arc)
+{
+    uint8_t* s = calloc((size_t)w*h, 1);
+    int offsets[16];
+    for(int k = 0; k < 16; ++k) offsets[k] = circle_y[k]*w + circle_x[k];
+
+    #pragma omp parallel for schedule(dynamic, 8)
+    for(int y = 3; y < h - 3; ++y) {
+        const uint8_t* row = g + y*w;
+        uint8_t* out = s + y*w;
+        int x = 3;
+#ifdef __SSE2__
+        for(; x + 16 <= w - 3; x += 16) {
+            int mask = segment_test16(row + x, offsets, t, arc);
+            while(mask) {
+                int i = __builtin_ctz(mask);
+                out[x + i] = corner_score(row + x + i, offsets, t, arc);
+                mask &= mask - 1;
+            }
+        }
+#endif
+        score_row_scalar(row, offsets, x, w - 3, t, arc, out);
+    }
+    return s;
+}
+
+point* fast_corners(image m, float thresh, int arc, int nms, int subpixel, float** score, int* n)
+{
+    arc = clamp(arc, 9, 12);
+    int t = clamp((int)(thresh*255.f + .5f), 1, 254);
+    uint8_t* g = gray_bytes(m);
+    uint8_t* s = fast_score_map(g, m.w, m.h, t, arc);
+    free(g);
+
+    // gather corners row by row, keeping ties only once by comparing > with earlier and >= with later neighbours
+    int** row_corners = calloc(m.h, sizeof(int*));
+    #pragma omp parallel for schedule(dynamic, 8)
+    for(int y = 3; y < m.h - 3; ++y) {
+        const uint8_t* r = s + y*m.w;
+        for(int x = 3; x < m.w - 3; ++x) {
+            int v = r[x];
+            if(!v) continue;
+            if(nms && !(v > r[x-1-m.w] && v > r[x-m.w] && v > r[x+1-m.w] && v > r[x-1] &&
+                        v >= r[x+1] && v >= r[x-1+m.w] && v >= r[x+m.w] && v >= r[x+1+m.w])) continue;
+            sb_push(row_corners[y], x);
+        }
+    }
+    int count = 0;
+    for(int y = 0; y < m.h; ++y) count += sb_count(row_corners[y]);
+
+    point* p = malloc((count ? count : 1)*sizeof(point));
+    float* sc = score ? malloc((count ? count : 1)*sizeof(float)) : NULL;
+    for(int y = 0, i = 0; y < m.h; ++y) {
+        for(int j = 0; j < sb_count(row_corners[y]); ++j, ++i) {
+            int x = row_corners[y][j];
+            p[i].x = x, p[i].y = y;
+            if(sc) sc[i] = s[y*m.w + x] / 255.f;
+        }
+        sb_free(row_corners[y]);
+    }
+    free(row_corners);
+    if(subpixel) {
+        image response = make_image(m.w, m.h, 1);
+        for(size_t i = 0; i < (size_t)m.w*m.h; ++i) response.data[i] = s[i];
+        refine_keypoints(response, p, count);
+        free_image(&response);
+    }
+    free(s);
+
+    if(score) *score = sc;
+    *n = count;
+    return p;
+}
+
+descriptor_set fast_corner_detector_set(image m, float thresh, int arc, int nms, int cell, int per_cell)
+{
+    int n;
+    float* score;
+    point* p = fast_corners(m, thresh, arc, nms, 0, &score, &n);
+    n = grid_bucket_keypoints(p, score, n, m.w, m.h, cell, per_cell);
+    descriptor_set s = describe_patches(m, p, score, n);
+    free(p); free(score);
+    return s;
+}
+
+descriptor* fast_corner_detector(image m, float thresh, int arc, int nms, int cell, int per_cell, int* n)
+{
+    descriptor_set s = fast_corner_detector_set(m, thresh, arc, nms, cell, per_cell);
+    descriptor* d = descriptor_array(s);
+    *n = s.n;
+    free_descriptor_set(&s);
+    return d;
+}
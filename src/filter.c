@@ -1,9 +1,12 @@
 #include "filter.h"
 
+#include "utils.h"
+
 #include <string.h>
 #include <math.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <float.h>
 
 image convolve_image(image m, image filter, int preserve)
 {
@@ -281,6 +284,91 @@ image erode_image(image m, int times)
     return out;
 }
 
+// running max over windows of k = 2r+1 samples (van Herk/Gil-Werman).
+// in must hold n + 2r values, padded with -FLT_MAX on both sides, g and h are scratch of the same size.
+// costs three comparisons per sample no matter how large the window is.
+static inline void running_max_1d(const float* in, float* out, float* g, float* h, int n, int r)
+{
+    int k = 2*r + 1, padded = n + 2*r;
+    for(int i = 0; i < padded; ++i) {
+        g[i] = (i % k == 0) ? in[i] : MAX(g[i-1], in[i]);
+    }
+    for(int i = padded - 1; i >= 0; --i) {
+        h[i] = (i == padded - 1 || (i + 1) % k == 0) ? in[i] : MAX(h[i+1], in[i]);
+    }
+    for(int i = 0; i < n; ++i) {
+        out[i] = MAX(h[i], g[i + 2*r]);
+    }
+}
+
+image max_filter_image(image m, int w)
+{
+    image out = make_image(m.w, m.h, m.c);
+    if(w < 1) {
+        memcpy(out.data, m.data, m.w*m.h*m.c*sizeof(float));
+        return out;
+    }
+    const int strip = 64;
+    // maximum along every row
+    #pragma omp parallel
+    {
+        float* buf = malloc(3*(m.w + 2*w)*sizeof(float));
+        float *g = buf + (m.w + 2*w), *h = buf + 2*(m.w + 2*w);
+        for(int i = 0; i < w; ++i) buf[i] = buf[m.w + w + i] = -FLT_MAX;
+        #pragma omp for
+        for(int i = 0; i < m.h*m.c; ++i) {
+            memcpy(buf + w, m.data + i*m.w, m.w*sizeof(float));
+            running_max_1d(buf, out.data + i*m.w, g, h, m.w, w);
+        }
+        free(buf);
+    }
+    // then along every column, a strip of columns at a time so rows can be processed as vectors
+    int num_strips = (m.w + strip - 1) / strip;
+    #pragma omp parallel
+    {
+        int padded = m.h + 2*w, k = 2*w + 1;
+        float* buf = malloc(3*padded*strip*sizeof(float));
+        float *g = buf + padded*strip, *h = buf + 2*padded*strip;
+        #pragma omp for collapse(2)
+        for(int c = 0; c < m.c; ++c) {
+            for(int s = 0; s < num_strips; ++s) {
+                int x0 = s*strip, sw = MIN(strip, m.w - x0);
+                float* plane = out.data + c*m.w*m.h;
+                for(int y = 0; y < padded; ++y) {
+                    float* row = buf + y*strip;
+                    if(y < w || y >= m.h + w) {
+                        for(int x = 0; x < sw; ++x) row[x] = -FLT_MAX;
+                    }
+                    else memcpy(row, plane + (y - w)*m.w + x0, sw*sizeof(float));
+                }
+                for(int y = 0; y < padded; ++y) {
+                    float *gr = g + y*strip, *in = buf + y*strip;
+                    if(y % k == 0) memcpy(gr, in, sw*sizeof(float));
+                    else {
+                        #pragma omp simd
+                        for(int x = 0; x < sw; ++x) gr[x] = MAX(gr[x - strip], in[x]);
+                    }
+                }
+                for(int y = padded - 1; y >= 0; --y) {
+                    float *hr = h + y*strip, *in = buf + y*strip;
+                    if(y == padded - 1 || (y + 1) % k == 0) memcpy(hr, in, sw*sizeof(float));
+                    else {
+                        #pragma omp simd
+                        for(int x = 0; x < sw; ++x) hr[x] = MAX(hr[x + strip], in[x]);
+                    }
+                }
+                for(int y = 0; y < m.h; ++y) {
+                    float *o = plane + y*m.w + x0, *hr = h + y*strip, *gr = g + (y + 2*w)*strip;
+                    #pragma omp simd
+                    for(int x = 0; x < sw; ++x) o[x] = MAX(hr[x], gr[x]);
+                }
+            }
+        }
+        free(buf);
+    }
+    return out;
+}
+
 static inline int hilditch_func_nc8(int *b)
 {
     int n_odd[4] = { 1, 3, 5, 7 }; // odd-number neighbors
@@ -1,10 +1,14 @@
 #include "harris.h"
 
 #include "filter.h"
+#include "keypoints.h"
+#include "utils.h"
+#include "stretchy_buffer.h"
 
 #include <stdlib.h>
-#include <assert.h>
+#include <string.h>
 #include <float.h>
+#include <math.h>
 
 // creates a descriptor for an index in an image
 static inline descriptor make_descriptor(image m, int idx)
@@ -48,7 +52,7 @@ image make_structure_matrix(image m, float sigma)
     image D = make_image(m.w, m.h, 3);
     #pragma omp parallel for
     for(int i = 0; i < n; ++i) {
-        int Ix = gx.data[i], Iy = gy.data[i];
+        float Ix = gx.data[i], Iy = gy.data[i];
         D.data[i] = Ix*Ix; 
         D.data[i + n] = Iy*Iy;
         D.data[i + 2*n] = Ix*Iy;
@@ -80,79 +84,287 @@ image harris_cornerness_response(image S)
     return R;
 }
 
-static inline void local_nms(image m, image* out, int x, int y, int w)
+// width of the box filter gaussian_noise_reduce uses for sigma, the fused path smooths the same way
+static inline int structure_blur_radius(float sigma)
 {
-    float val = get_pixel(m, x, y, 0);
-    for(int dy = -w; dy <= w; ++dy) {
-        for(int dx = -w; dx <= w; ++dx) {
-            float neighbor_val = get_pixel(m, x+dx, y+dy, 0);
-            if(neighbor_val > val) {
-                set_pixel(out, x, y, 0, -FLT_MAX);
-                return;
+    int w = ((int)(sqrtf(3*sigma*sigma+1))) | 1;
+    return (w - 1)/2;
+}
+
+static inline float corner_measure(float IxIx, float IyIy, float IxIy, corner_response_type type)
+{
+    if(type == SHI_TOMASI_RESPONSE) {
+        // smallest eigenvalue of the structure matrix
+        float half_trace = 0.5f*(IxIx + IyIy), half_diff = 0.5f*(IxIx - IyIy);
+        return half_trace - sqrtf(half_diff*half_diff + IxIy*IxIy);
+    }
+    const float alpha = 0.06;
+    float det = IxIx*IyIy - IxIy*IxIy;
+    float trace = IxIx + IyIy;
+    return det - alpha*trace*trace;
+}
+
+// computes the response for the tile [x0, x1) x [y0, y1) of the output.
+// scratch must hold CORNER_TILE_SCRATCH floats for the blur radius r.
+#define CORNER_TILE_W 128
+#define CORNER_TILE_H 64
+#define CORNER_TILE_SCRATCH(r) ((CORNER_TILE_W + 2*(r) + 2)*(CORNER_TILE_H + 2*(r) + 2) + 6*(CORNER_TILE_W + 2*(r))*(CORNER_TILE_H + 2*(r)))
+static void corner_response_tile(image m, image* R, int x0, int y0, int x1, int y1, int r, corner_response_type type, float* scratch)
+{
+    // products are needed for every image pixel the blur reaches, gradients one pixel further
+    int ax = MAX(0, x0 - r), bx = MIN(m.w, x1 + r);
+    int ay = MAX(0, y0 - r), by = MIN(m.h, y1 + r);
+    int iw = bx - ax + 2, ih = by - ay + 2;
+    int pw = bx - ax, ph = by - ay, tw = x1 - x0;
+    float* I = scratch;
+    float* P = I + iw*ih;
+    float* H = P + 3*pw*ph;
+
+    // intensity summed over channels, zero outside the image like convolve_image
+    for(int y = 0; y < ih; ++y) {
+        int sy = ay - 1 + y;
+        float* row = I + y*iw;
+        for(int x = 0; x < iw; ++x) row[x] = 0.f;
+        if(sy < 0 || sy >= m.h) continue;
+        for(int k = 0; k < m.c; ++k) {
+            const float* src = m.data + k*m.w*m.h + sy*m.w;
+            int xs = MAX(0, ax - 1), xe = MIN(m.w, bx + 1);
+            #pragma omp simd
+            for(int x = xs; x < xe; ++x) row[x - (ax - 1)] += src[x];
+        }
+    }
+    // sobel gradients and their products
+    for(int y = 0; y < ph; ++y) {
+        const float* r0 = I + y*iw;
+        const float* r1 = r0 + iw;
+        const float* r2 = r1 + iw;
+        float* pxx = P + y*pw;
+        float* pyy = pxx + pw*ph;
+        float* pxy = pyy + pw*ph;
+        #pragma omp simd
+        for(int x = 0; x < pw; ++x) {
+            float Ix = (r0[x+2] + 2*r1[x+2] + r2[x+2]) - (r0[x] + 2*r1[x] + r2[x]);
+            float Iy = (r2[x] + 2*r2[x+1] + r2[x+2]) - (r0[x] + 2*r0[x+1] + r0[x+2]);
+            pxx[x] = Ix*Ix;
+            pyy[x] = Iy*Iy;
+            pxy[x] = Ix*Iy;
+        }
+    }
+    // box blur along rows, replicating the image border
+    const float gamma = 1.f / (2*r + 1);
+    for(int c = 0; c < 3; ++c) {
+        for(int y = 0; y < ph; ++y) {
+            const float* src = P + c*pw*ph + y*pw;
+            float* dst = H + c*tw*ph + y*tw;
+            if(x0 - r >= 0 && x1 + r <= m.w) {
+                // away from the border every tap is inside the product buffer
+                const float* s0 = src + (x0 - r - ax);
+                for(int x = 0; x < tw; ++x) dst[x] = 0.f;
+                for(int dx = 0; dx <= 2*r; ++dx) {
+                    #pragma omp simd
+                    for(int x = 0; x < tw; ++x) dst[x] += s0[x + dx];
+                }
+                #pragma omp simd
+                for(int x = 0; x < tw; ++x) dst[x] *= gamma;
+            }
+            else {
+                for(int x = x0; x < x1; ++x) {
+                    float sum = 0.f;
+                    for(int dx = -r; dx <= r; ++dx) sum += src[clamp(x + dx, 0, m.w - 1) - ax];
+                    dst[x - x0] = sum*gamma;
+                }
+            }
+        }
+    }
+    // box blur along columns, then the response
+    for(int y = y0; y < y1; ++y) {
+        float* out = R->data + y*R->w + x0;
+        float sxx[CORNER_TILE_W], syy[CORNER_TILE_W], sxy[CORNER_TILE_W];
+        for(int x = 0; x < tw; ++x) sxx[x] = syy[x] = sxy[x] = 0.f;
+        for(int dy = -r; dy <= r; ++dy) {
+            int sy = clamp(y + dy, 0, m.h - 1) - ay;
+            const float* hxx = H + sy*tw;
+            const float* hyy = hxx + tw*ph;
+            const float* hxy = hyy + tw*ph;
+            #pragma omp simd
+            for(int x = 0; x < tw; ++x) {
+                sxx[x] += hxx[x];
+                syy[x] += hyy[x];
+                sxy[x] += hxy[x];
             }
         }
+        for(int x = 0; x < tw; ++x) {
+            out[x] = corner_measure(sxx[x]*gamma, syy[x]*gamma, sxy[x]*gamma, type);
+        }
     }
 }
 
+image corner_response(image m, float sigma, corner_response_type type)
+{
+    image R = make_image(m.w, m.h, 1);
+    int r = structure_blur_radius(sigma);
+    int tiles_x = (m.w + CORNER_TILE_W - 1) / CORNER_TILE_W;
+    int tiles_y = (m.h + CORNER_TILE_H - 1) / CORNER_TILE_H;
+    #pragma omp parallel
+    {
+        float* scratch = malloc(CORNER_TILE_SCRATCH(r)*sizeof(float));
+        #pragma omp for schedule(dynamic)
+        for(int t = 0; t < tiles_x*tiles_y; ++t) {
+            int x0 = (t % tiles_x)*CORNER_TILE_W, y0 = (t / tiles_x)*CORNER_TILE_H;
+            int x1 = MIN(m.w, x0 + CORNER_TILE_W), y1 = MIN(m.h, y0 + CORNER_TILE_H);
+            corner_response_tile(m, &R, x0, y0, x1, y1, r, type, scratch);
+        }
+        free(scratch);
+    }
+    return R;
+}
+
+// a pixel survives if it is the maximum of its (2w+1)x(2w+1) window, ties survive too.
+// The window is padded with 0 outside the image as get_pixel did, so negative responses within w
+// of the border are suppressed, while max_filter_image pads with -FLT_MAX.
 image harris_nms_image(image m, int w)
 {
-    image out = copy_image(m);
+    image out = max_filter_image(m, w);
     #pragma omp parallel for
     for(int y = 0; y < m.h; ++y) {
+        int border_row = y < w || y >= m.h - w;
         for(int x = 0; x < m.w; ++x) {
-            local_nms(m, &out, x, y, w);
+            int i = y*m.w + x;
+            float max = border_row || x < w || x >= m.w - w ? MAX(out.data[i], 0) : out.data[i];
+            out.data[i] = m.data[i] == max ? m.data[i] : -FLT_MAX;
         }
     }
     return out;
 }
 
+// returns the indexes of the pixels above thresh in R_nms, in raster order.
+// bands of rows gather their corners in parallel, then the bands are concatenated.
+static int* collect_corners(image R_nms, float thresh, int* n)
+{
+    const int band_height = 16;
+    int num_bands = (R_nms.h + band_height - 1) / band_height;
+    int** band_corners = calloc(num_bands, sizeof(int*));
+    int* band_offset = calloc(num_bands + 1, sizeof(int));
+    #pragma omp parallel for schedule(dynamic)
+    for(int b = 0; b < num_bands; ++b) {
+        int end = MIN(R_nms.h, (b + 1)*band_height)*R_nms.w;
+        for(int i = b*band_height*R_nms.w; i < end; ++i) {
+            if(R_nms.data[i] > thresh) sb_push(band_corners[b], i);
+        }
+        band_offset[b + 1] = (int)sb_count(band_corners[b]);
+    }
+    for(int b = 0; b < num_bands; ++b) band_offset[b + 1] += band_offset[b];
+
+    *n = band_offset[num_bands];
+    int* corners = malloc((*n ? *n : 1)*sizeof(int));
+    #pragma omp parallel for
+    for(int b = 0; b < num_bands; ++b) {
+        if(band_corners[b]) {
+            memcpy(corners + band_offset[b], band_corners[b], sb_count(band_corners[b])*sizeof(int));
+        }
+        sb_free(band_corners[b]);
+    }
+    free(band_corners);
+    free(band_offset);
+    return corners;
+}
+
 descriptor* harris_corner_detector(image m, float sigma, float thresh, int nms, int* n)
 {
-    // calculate structure matrix
-    image S = make_structure_matrix(m, sigma);
-    // estimate cornerness using the structure matrix
-    image R = harris_cornerness_response(S);
+    // estimate cornerness from the smoothed structure matrix, computed tile by tile
+    image R = corner_response(m, sigma, HARRIS_RESPONSE);
     // run nms on the responses
     image R_nms = harris_nms_image(R, nms);
 
-    int count = 0;
-    #pragma omp parallel for reduction(+:count)
-    for(int i = 0; i < m.h*m.w; ++i) {
-        if(R_nms.data[i] > thresh) ++count;
-    }
-
+    int count;
+    int* corners = collect_corners(R_nms, thresh, &count);
     *n = count;
     descriptor* d = calloc(count, sizeof(descriptor));
-    int j = 0;
-    for(int i = 0; i < m.h*m.w; ++i) {
-        if(R_nms.data[i] > thresh) {
-            d[j++] = make_descriptor(m, i);
-        }
+    #pragma omp parallel for
+    for(int i = 0; i < count; ++i) {
+        d[i] = make_descriptor(m, corners[i]);
     }
-    assert(j == count);
 
-    free_image(&S);
+    free(corners);
     free_image(&R);
     free_image(&R_nms);
     return d;
 }
 
+point* harris_corners(image m, float sigma, corner_response_type type, float thresh, int nms, int subpixel, float** score, int* n)
+{
+    image R = corner_response(m, sigma, type);
+    image R_nms = harris_nms_image(R, nms);
+
+    int count;
+    int* corners = collect_corners(R_nms, thresh, &count);
+    point* p = malloc((count ? count : 1)*sizeof(point));
+    float* sc = score ? malloc((count ? count : 1)*sizeof(float)) : NULL;
+    #pragma omp parallel for
+    for(int i = 0; i < count; ++i) {
+        p[i].x = corners[i] % m.w, p[i].y = corners[i] / m.w;
+        if(sc) sc[i] = R.data[corners[i]];
+    }
+    if(subpixel) refine_keypoints(R, p, count);
+
+    free(corners);
+    free_image(&R);
+    free_image(&R_nms);
+    if(score) *score = sc;
+    *n = count;
+    return p;
+}
+
+descriptor_set harris_corner_detector_set(image m, float sigma, float thresh, int nms)
+{
+    int count;
+    float* score;
+    point* p = harris_corners(m, sigma, HARRIS_RESPONSE, thresh, nms, 0, &score, &count);
+    descriptor_set s = describe_patches(m, p, score, count);
+    free(p); free(score);
+    return s;
+}
+
+static inline void draw_corner(image* m, int x, int y)
+{
+    for(int j = -9; j <= 9; ++j) {
+        set_pixel(m, x+j, y, 0, 1.f);
+        set_pixel(m, x, y+j, 0, 1.f);
+        set_pixel(m, x+j, y, 1, 0.f);
+        set_pixel(m, x, y+j, 1, 0.f);
+        set_pixel(m, x+j, y, 2, 1.f);
+        set_pixel(m, x, y+j, 2, 1.f);
+    }
+}
+
 void draw_corners(image* m, descriptor* d, int n)
 {
     #pragma omp parallel for
     for(int i = 0; i < n; ++i) {
-        int x = d[i].p.x, y = d[i].p.y;
-        for(int j = -9; j <= 9; ++j) {
-            set_pixel(m, x+j, y, 0, 1.f);
-            set_pixel(m, x, y+j, 0, 1.f);
-            set_pixel(m, x+j, y, 1, 0.f);
-            set_pixel(m, x, y+j, 1, 0.f);
-            set_pixel(m, x+j, y, 2, 1.f);
-            set_pixel(m, x, y+j, 2, 1.f);
-        }
+        draw_corner(m, d[i].p.x, d[i].p.y);
     }
 }
 
+void draw_corner_set(image* m, descriptor_set s)
+{
+    #pragma omp parallel for
+    for(int i = 0; i < s.n; ++i) {
+        draw_corner(m, s.p[i].x, s.p[i].y);
+    }
+}
+
+descriptor* descriptor_array(descriptor_set s)
+{
+    descriptor* d = calloc(s.n ? s.n : 1, sizeof(descriptor));
+    for(int i = 0; i < s.n; ++i) {
+        d[i].p = s.p[i];
+        d[i].n = s.d;
+        d[i].data = malloc(s.d*sizeof(float));
+        memcpy(d[i].data, descriptor_row(s, i), s.d*sizeof(float));
+    }
+    return d;
+}
+
 void free_descriptors(descriptor* d, int n)
 {
     for(int i = 0; i < n; ++i) {
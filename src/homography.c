@@ -0,0 +1,48 @@
+#include "homography.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void project_points(hom3 H, const point* in, point* out, int n)
+{
+    int i = 0;
+#ifdef __SSE2__
+    __m128 h[3][3];
+    for(int r = 0; r < 3; ++r) {
+        for(int c = 0; c < 3; ++c) h[r][c] = _mm_set1_ps(H.h[r][c]);
+    }
+    for(; i + 4 <= n; i += 4) {
+        // x0 y0 x1 y1 and x2 y2 x3 y3 to x0..x3 and y0..y3
+        __m128 a = _mm_loadu_ps(&in[i].x), b = _mm_loadu_ps(&in[i+2].x);
+        __m128 x = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 y = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        __m128 w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(h[2][0], x), _mm_mul_ps(h[2][1], y)), h[2][2]);
+        __m128 px = _mm_add_ps(_mm_add_ps(_mm_mul_ps(h[0][0], x), _mm_mul_ps(h[0][1], y)), h[0][2]);
+        __m128 py = _mm_add_ps(_mm_add_ps(_mm_mul_ps(h[1][0], x), _mm_mul_ps(h[1][1], y)), h[1][2]);
+        px = _mm_div_ps(px, w);
+        py = _mm_div_ps(py, w);
+        _mm_storeu_ps(&out[i].x, _mm_unpacklo_ps(px, py));
+        _mm_storeu_ps(&out[i+2].x, _mm_unpackhi_ps(px, py));
+    }
+#endif
+    for(; i < n; ++i) out[i] = hom3_project(H, in[i]);
+}
+
+hom3 matrix_to_hom3(matrix m)
+{
+    hom3 H;
+    for(int i = 0; i < 3; ++i) {
+        for(int j = 0; j < 3; ++j) H.h[i][j] = m.data[i][j];
+    }
+    return H;
+}
+
+matrix hom3_to_matrix(hom3 H)
+{
+    matrix m = make_matrix(3, 3);
+    for(int i = 0; i < 3; ++i) {
+        for(int j = 0; j < 3; ++j) m.data[i][j] = H.h[i][j];
+    }
+    return m;
+}
@@ -1,55 +1,228 @@
 #include "hough.h"
 #include "draw.h"
+#include "filter.h"
+#include "utils.h"
 
 #include "stretchy_buffer.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #define DEG2RAD 0.017453293f
 
-accumulator hough_transform(image m)
+// adds a thread-private histogram into the shared accumulator
+static inline void merge_accumulator(accumulator a, unsigned int* histogram)
 {
-    accumulator a;
-    //Create the accumulator
-    float hough_h = sqrtf(2.f)*(m.h > m.w ? m.h : m.w) / 2.f;
-    a.h = hough_h*2, a.w = 180;
+    #pragma omp critical
+    {
+        for(int i = 0; i < a.w*a.h; ++i) a.histogram[i] += histogram[i];
+    }
+}
 
+static inline accumulator make_line_accumulator(int w, int h, float* hough_h, float* cos_table, float* sin_table)
+{
+    accumulator a;
+    *hough_h = sqrtf(2.f)*(h > w ? h : w) / 2.f;
+    a.h = *hough_h*2, a.w = 180;
     a.histogram = (unsigned int*)calloc(a.w*a.h, sizeof(unsigned int));
+    for(int t = 0; t < 180; ++t) {
+        cos_table[t] = cosf(t*DEG2RAD);
+        sin_table[t] = sinf(t*DEG2RAD);
+    }
+    return a;
+}
+
+// votes for every line through the pixel (x, y), given relative to the image center
+static inline void hough_vote(unsigned int* histogram, int h, float x, float y, float hough_h, const float* cos_table, const float* sin_table)
+{
+    for(int t = 0; t < 180; ++t) {
+        float r = (x*cos_table[t]) + (y*sin_table[t]);
+        int ri = (int)roundf(r + hough_h);
+        if(ri >= h) ri = h - 1;
+        ++histogram[ri*180 + t];
+    }
+}
+
+accumulator hough_transform(image m)
+{
+    float hough_h, cos_table[180], sin_table[180];
+    //Create the accumulator
+    accumulator a = make_line_accumulator(m.w, m.h, &hough_h, cos_table, sin_table);
 
     float center_x = m.w/2.f, center_y = m.h/2.f;
-    #pragma omp parallel for schedule(dynamic)
-    for(int y = 0; y < m.h; ++y) {
-        for(int x = 0; x < m.w; ++x) {
-            if(m.data[y*m.w + x] == 1.f) {
-                for(int t = 0; t < 180; ++t) {
-                    float r = ((x - center_x)*cosf(t*DEG2RAD)) + ((y - center_y)*sinf(t*DEG2RAD));
-                    #pragma omp atomic update
-                    ++a.histogram[(int)((round(r + hough_h)*180.f)) + t];
+    #pragma omp parallel
+    {
+        // every thread votes into its own accumulator, which are summed up at the end
+        unsigned int* histogram = (unsigned int*)calloc(a.w*a.h, sizeof(unsigned int));
+        #pragma omp for schedule(dynamic) nowait
+        for(int y = 0; y < m.h; ++y) {
+            for(int x = 0; x < m.w; ++x) {
+                if(m.data[y*m.w + x] == 1.f) {
+                    hough_vote(histogram, a.h, x - center_x, y - center_y, hough_h, cos_table, sin_table);
                 }
             }
         }
+        merge_accumulator(a, histogram);
+        free(histogram);
     }
     return a;
 }
 
-static inline int find_local_maximum(accumulator a, int r, int t)
+accumulator hough_transform_rle(rle_image m)
 {
-    int max = (int)a.histogram[r*a.w + t];
-    for (int ly = -4; ly <= 4; ++ly) {
-        for (int lx = -4; lx <= 4; ++lx) {
-            if ((ly + r >= 0 && ly + r < a.h) && (lx + t >= 0 && lx + t < a.w)) {
-                if ((int)a.histogram[(r + ly)*a.w + (t + lx)] > max) {
-                    max = (int)a.histogram[(r + ly)*a.w + (t + lx)];
-                    ly = lx = 5;
+    float hough_h, cos_table[180], sin_table[180];
+    accumulator a = make_line_accumulator(m.w, m.h, &hough_h, cos_table, sin_table);
+
+    float center_x = m.w/2.f, center_y = m.h/2.f;
+    #pragma omp parallel
+    {
+        unsigned int* histogram = (unsigned int*)calloc(a.w*a.h, sizeof(unsigned int));
+        // only the pixels inside runs are visited, background costs nothing
+        #pragma omp for schedule(dynamic) nowait
+        for(int y = 0; y < m.h; ++y) {
+            for(int i = m.row_start[y]; i < m.row_start[y + 1]; ++i) {
+                for(int x = m.runs[i].xs; x < m.runs[i].xe; ++x) {
+                    hough_vote(histogram, a.h, x - center_x, y - center_y, hough_h, cos_table, sin_table);
                 }
             }
         }
+        merge_accumulator(a, histogram);
+        free(histogram);
+    }
+    return a;
+}
+
+// min-heap of accumulator cells ordered by votes, ties broken towards the lower index
+static inline int peak_less(const unsigned int* votes, int a, int b)
+{
+    return votes[a] < votes[b] || (votes[a] == votes[b] && a > b);
+}
+
+static inline void peak_heap_sift_down(int* heap, const unsigned int* votes, int size, int i)
+{
+    for(;;) {
+        int l = 2*i + 1, r = l + 1, smallest = i;
+        if(l < size && peak_less(votes, heap[l], heap[smallest])) smallest = l;
+        if(r < size && peak_less(votes, heap[r], heap[smallest])) smallest = r;
+        if(smallest == i) return;
+        int tmp = heap[i]; heap[i] = heap[smallest]; heap[smallest] = tmp;
+        i = smallest;
     }
-    return max;
+}
+
+// keeps the k strongest cells pushed so far
+static inline void peak_heap_push(int* heap, const unsigned int* votes, int* size, int k, int cell)
+{
+    if(*size == k) {
+        if(peak_less(votes, cell, heap[0])) return;
+        heap[0] = cell;
+        peak_heap_sift_down(heap, votes, k, 0);
+        return;
+    }
+    int i = (*size)++;
+    heap[i] = cell;
+    while(i > 0 && peak_less(votes, heap[i], heap[(i - 1)/2])) {
+        int parent = (i - 1)/2;
+        int tmp = heap[i]; heap[i] = heap[parent]; heap[parent] = tmp;
+        i = parent;
+    }
+}
+
+// returns the indexes of all accumulator cells with at least threshold votes,
+// that are also the maximum of their 9x9 neighborhood.
+// int k: only return the k strongest peaks, strongest first. 0 for all peaks in raster order.
+static int* find_accumulator_peaks(accumulator a, int threshold, int k, int* num_peaks)
+{
+    const int radius = 4;
+    image votes = make_image(a.w, a.h, 1);
+    #pragma omp parallel for
+    for(int i = 0; i < a.w*a.h; ++i) votes.data[i] = (float)a.histogram[i];
+    image local_max = max_filter_image(votes, radius);
+
+    // count the peaks of every row in parallel, then write them out at their row offset
+    int* row_offset = calloc(a.h + 1, sizeof(int));
+    #pragma omp parallel for
+    for(int r = 0; r < a.h; ++r) {
+        int count = 0;
+        for(int t = 0; t < a.w; ++t) {
+            int i = r*a.w + t;
+            count += (int)a.histogram[i] >= threshold && votes.data[i] == local_max.data[i];
+        }
+        row_offset[r + 1] = count;
+    }
+    for(int r = 0; r < a.h; ++r) row_offset[r + 1] += row_offset[r];
+    int n = row_offset[a.h];
+    int* peaks = malloc((n ? n : 1)*sizeof(int));
+    #pragma omp parallel for
+    for(int r = 0; r < a.h; ++r) {
+        int j = row_offset[r];
+        for(int t = 0; t < a.w; ++t) {
+            int i = r*a.w + t;
+            if((int)a.histogram[i] >= threshold && votes.data[i] == local_max.data[i]) peaks[j++] = i;
+        }
+    }
+    free(row_offset);
+    free_image(&votes);
+    free_image(&local_max);
+
+    if(k > 0 && n > 0) {
+        int size = 0;
+        int* heap = malloc(MIN(k, n)*sizeof(int));
+        for(int i = 0; i < n; ++i) {
+            peak_heap_push(heap, a.histogram, &size, MIN(k, n), peaks[i]);
+        }
+        free(peaks);
+        // pop the weakest to the back, leaving the strongest first
+        for(int i = size - 1; i > 0; --i) {
+            int tmp = heap[0]; heap[0] = heap[i]; heap[i] = tmp;
+            peak_heap_sift_down(heap, a.histogram, i, 0);
+        }
+        peaks = heap, n = size;
+    }
+    *num_peaks = n;
+    return peaks;
 }
 
 line* hough_line_detect(image m, int threshold, int* num_lines)
+{
+    return hough_line_detect_k(m, threshold, 0, num_lines);
+}
+
+// turns the peaks of a line accumulator for a w x h image into lines clipped to the image borders
+static line* lines_from_accumulator(accumulator a, int w, int h, int threshold, int k, int* num_lines)
+{
+    line* lines = 0, l;
+    if(threshold < 1) threshold = w > h ? w / 3 : h / 3;
+    int num_peaks;
+    int* peaks = find_accumulator_peaks(a, threshold, k, &num_peaks);
+    for (int i = 0; i < num_peaks; ++i) {
+        int r = peaks[i] / a.w, t = peaks[i] % a.w;
+        int x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+        if (t >= 45 && t <= 135) {
+            // y = (r - x cos(t)) / sin(t)
+            x1 = 0;
+            y1 = ((float)(r - (a.h/2.f)) - ((x1 - (w/2.f))*cosf(t*DEG2RAD))) / sinf(t*DEG2RAD) + (h/2.f);
+            x2 = w - 0;
+            y2 = ((float)(r - (a.h/2.f)) - ((x2 - (w/2.f))*cosf(t*DEG2RAD))) / sinf(t*DEG2RAD) + (h/2.f);
+        }
+        else {
+            // x = (r - y sin(t)) / cos(t)
+            y1 = 0;
+            x1 = ((float)(r - (a.h/2.f)) - ((y1 - (h/2.f))*sinf(t*DEG2RAD)))/cosf(t*DEG2RAD) + (w/2.f);
+            y2 = h - 0;
+            x2 = ((float)(r - (a.h/2.f)) - ((y2 - (h/2.f))*sinf(t*DEG2RAD)))/cosf(t*DEG2RAD) + (w/2.f);
+        }
+        l.start.x = x1, l.start.y = y1;
+        l.end.x   = x2, l.end.y   = y2;
+        sb_push(lines, l);
+    }
+    free(peaks);
+    *num_lines = (int)sb_count(lines);
+    return lines;
+}
+
+line* hough_line_detect_k(image m, int threshold, int k, int* num_lines)
 {
     // Require a binary image output from canny
     if (!m.data || m.c != 1) {
@@ -57,40 +230,281 @@ line* hough_line_detect(image m, int threshold, int* num_lines)
         return 0;
     }
     accumulator a = hough_transform(m);
-    line* lines = 0, l;
+    line* lines = lines_from_accumulator(a, m.w, m.h, threshold, k, num_lines);
+    free(a.histogram);
+    return lines;
+}
+
+line* hough_line_detect_rle(rle_image m, int threshold, int k, int* num_lines)
+{
+    accumulator a = hough_transform_rle(m);
+    line* lines = lines_from_accumulator(a, m.w, m.h, threshold, k, num_lines);
+    free(a.histogram);
+    return lines;
+}
+
+// walks from (x0, y0) along the step (sx, sy) while the gap between edge pixels is at most max_gap.
+// returns the last edge pixel visited on the way.
+static inline point walk_segment(unsigned char* mask, int w, int h, int x0, int y0, float sx, float sy, int max_gap)
+{
+    point end = { x0, y0 };
+    int gap = 0;
+    for(int k = 1;; ++k) {
+        int x = (int)roundf(x0 + k*sx), y = (int)roundf(y0 + k*sy);
+        if(x < 0 || x >= w || y < 0 || y >= h) break;
+        if(mask[y*w + x]) {
+            gap = 0;
+            end.x = x, end.y = y;
+        }
+        else if(++gap > max_gap) break;
+    }
+    return end;
+}
+
+line* hough_line_segments_detect(image m, int threshold, int min_length, int max_gap, int max_lines, int* num_lines)
+{
+    // Require a binary image output from canny
+    if (!m.data || m.c != 1) {
+        *num_lines = 0;
+        return 0;
+    }
+    if(threshold < 1) threshold = m.w > m.h ? m.w / 10 : m.h / 10;
+    if(min_length < 1) min_length = threshold;
+
+    const int w = m.w, h = m.h, num_theta = 180;
+    const int max_rho = (int)ceilf(sqrtf(w*w + h*h)), num_rho = 2*max_rho + 1;
+    float cos_table[180], sin_table[180];
+    for(int t = 0; t < num_theta; ++t) {
+        cos_table[t] = cosf(t*DEG2RAD);
+        sin_table[t] = sinf(t*DEG2RAD);
+    }
 
-    if(threshold < 1) threshold = m.w > m.h ? m.w / 3 : m.h / 3;
-    for (int r = 0; r < a.h; ++r) {
-        for (int t = 0; t < a.w; ++t) {
-            if((int)a.histogram[r*a.w + t] < threshold) continue;
-            int max = find_local_maximum(a, r, t);
-            if(max > (int)a.histogram[r*a.w + t]) continue;
-
-            int x1 = 0, y1 = 0, x2 = 0, y2 = 0;
-            if (t >= 45 && t <= 135) {
-                // y = (r - x cos(t)) / sin(t)
-                x1 = 0;
-                y1 = ((float)(r - (a.h/2.f)) - ((x1 - (m.w/2.f))*cosf(t*DEG2RAD))) / sinf(t*DEG2RAD) + (m.h/2.f);
-                x2 = m.w - 0;
-                y2 = ((float)(r - (a.h/2.f)) - ((x2 - (m.w/2.f))*cosf(t*DEG2RAD))) / sinf(t*DEG2RAD) + (m.h/2.f);
+    // 0 = background, 1 = unvisited edge pixel, 2 = edge pixel that has voted
+    unsigned char* mask = calloc(w*h, sizeof(unsigned char));
+    int* points = NULL;
+    for(int i = 0; i < w*h; ++i) {
+        if(m.data[i] == 1.f) {
+            mask[i] = 1;
+            sb_push(points, i);
+        }
+    }
+    int num_points = (int)sb_count(points);
+
+    // visit the edge pixels in random order, but reproducibly
+    unsigned int seed = 0x9e3779b9u;
+    for(int i = num_points - 1; i > 0; --i) {
+        int j = xorshift32(&seed) % (i + 1);
+        int tmp = points[i];
+        points[i] = points[j];
+        points[j] = tmp;
+    }
+
+    unsigned int* histogram = calloc(num_rho*num_theta, sizeof(unsigned int));
+    line* lines = 0;
+    for(int i = 0; i < num_points; ++i) {
+        int p = points[i], x = p % w, y = p / w;
+        // skip pixels that were already consumed by an earlier segment
+        if(!mask[p]) continue;
+        mask[p] = 2;
+
+        unsigned int max_votes = 0;
+        int max_t = 0;
+        for(int t = 0; t < num_theta; ++t) {
+            int r = (int)roundf(x*cos_table[t] + y*sin_table[t]) + max_rho;
+            unsigned int votes = ++histogram[r*num_theta + t];
+            if(votes > max_votes) {
+                max_votes = votes;
+                max_t = t;
             }
-            else {
-                // x = (r - y sin(t)) / cos(t)
-                y1 = 0;
-                x1 = ((float)(r - (a.h/2.f)) - ((y1 - (m.h/2.f))*sinf(t*DEG2RAD)))/cosf(t*DEG2RAD) + (m.w/2.f);
-                y2 = m.h - 0;
-                x2 = ((float)(r - (a.h/2.f)) - ((y2 - (m.h/2.f))*sinf(t*DEG2RAD)))/cosf(t*DEG2RAD) + (m.w/2.f);
+        }
+        if((int)max_votes < threshold) continue;
+
+        // step one pixel along the dominant axis of the line direction
+        float dx = -sin_table[max_t], dy = cos_table[max_t];
+        float scale = 1.f / MAX(fabsf(dx), fabsf(dy));
+        float sx = dx*scale, sy = dy*scale;
+
+        point end0 = walk_segment(mask, w, h, x, y, sx, sy, max_gap);
+        point end1 = walk_segment(mask, w, h, x, y, -sx, -sy, max_gap);
+        float length = sqrtf((end1.x - end0.x)*(end1.x - end0.x) + (end1.y - end0.y)*(end1.y - end0.y));
+        int good_line = length >= min_length;
+
+        // consume the pixels of the segment, and withdraw their votes if the segment is kept
+        for(int k = 0; k < 2; ++k) {
+            point end = k == 0 ? end0 : end1;
+            float ssx = k == 0 ? sx : -sx, ssy = k == 0 ? sy : -sy;
+            for(int j = 0;; ++j) {
+                int px = (int)roundf(x + j*ssx), py = (int)roundf(y + j*ssy);
+                if(px < 0 || px >= w || py < 0 || py >= h) break;
+                int q = py*w + px;
+                if(mask[q] == 2 && good_line) {
+                    for(int t = 0; t < num_theta; ++t) {
+                        int r = (int)roundf(px*cos_table[t] + py*sin_table[t]) + max_rho;
+                        --histogram[r*num_theta + t];
+                    }
+                }
+                mask[q] = 0;
+                if(px == (int)end.x && py == (int)end.y) break;
             }
-            l.start.x = x1, l.start.y = y1;
-            l.end.x   = x2, l.end.y   = y2;
+        }
+
+        if(good_line) {
+            line l = { end1, end0 };
             sb_push(lines, l);
+            if(max_lines > 0 && (int)sb_count(lines) >= max_lines) break;
         }
     }
-    free(a.histogram);
+    free(histogram);
+    free(mask);
+    sb_free(points);
     *num_lines = (int)sb_count(lines);
     return lines;
 }
 
+// gradient of the intensity at (x, y) from a 3x3 sobel kernel, summed over channels
+static inline void sobel_gradient(image m, int x, int y, float* gx, float* gy)
+{
+    float sx = 0, sy = 0;
+    for(int k = 0; k < m.c; ++k) {
+        float p00 = get_pixel(m, x-1, y-1, k), p10 = get_pixel(m, x, y-1, k), p20 = get_pixel(m, x+1, y-1, k);
+        float p01 = get_pixel(m, x-1, y,   k),                                p21 = get_pixel(m, x+1, y,   k);
+        float p02 = get_pixel(m, x-1, y+1, k), p12 = get_pixel(m, x, y+1, k), p22 = get_pixel(m, x+1, y+1, k);
+        sx += (p20 + 2*p21 + p22) - (p00 + 2*p01 + p02);
+        sy += (p02 + 2*p12 + p22) - (p00 + 2*p10 + p20);
+    }
+    *gx = sx, *gy = sy;
+}
+
+accumulator hough_circle_transform(image m, image edges, int min_radius, int max_radius)
+{
+    accumulator a;
+    a.w = edges.w, a.h = edges.h;
+    a.histogram = (unsigned int*)calloc(a.w*a.h, sizeof(unsigned int));
+
+    // sobel directions on a hard edge are off by several degrees, smoothing first makes the rays meet
+    image smooth = gaussian_noise_reduce(m, 2.f);
+    #pragma omp parallel
+    {
+        unsigned int* histogram = (unsigned int*)calloc(a.w*a.h, sizeof(unsigned int));
+        #pragma omp for schedule(dynamic) nowait
+        for(int y = 0; y < edges.h; ++y) {
+            for(int x = 0; x < edges.w; ++x) {
+                if(edges.data[y*edges.w + x] != 1.f) continue;
+                float gx, gy;
+                sobel_gradient(smooth, x, y, &gx, &gy);
+                float magnitude = sqrtf(gx*gx + gy*gy);
+                if(magnitude < 1e-6f) continue;
+                // the center lies on the gradient ray, on either side depending on the contrast
+                float ux = gx / magnitude, uy = gy / magnitude;
+                for(int r = min_radius; r <= max_radius; ++r) {
+                    for(int sign = -1; sign <= 1; sign += 2) {
+                        int cx = (int)roundf(x + sign*r*ux), cy = (int)roundf(y + sign*r*uy);
+                        if(cx < 0 || cx >= a.w || cy < 0 || cy >= a.h) continue;
+                        ++histogram[cy*a.w + cx];
+                    }
+                }
+            }
+        }
+        merge_accumulator(a, histogram);
+        free(histogram);
+    }
+    free_image(&smooth);
+
+    // the rays of a circle only meet approximately, so gather the votes of every center's 3x3 neighborhood
+    unsigned int* rows = (unsigned int*)calloc(a.w*a.h, sizeof(unsigned int));
+    #pragma omp parallel for
+    for(int y = 0; y < a.h; ++y) {
+        for(int x = 0; x < a.w; ++x) {
+            unsigned int sum = a.histogram[y*a.w + x];
+            if(x > 0) sum += a.histogram[y*a.w + x - 1];
+            if(x < a.w - 1) sum += a.histogram[y*a.w + x + 1];
+            rows[y*a.w + x] = sum;
+        }
+    }
+    #pragma omp parallel for
+    for(int y = 0; y < a.h; ++y) {
+        for(int x = 0; x < a.w; ++x) {
+            unsigned int sum = rows[y*a.w + x];
+            if(y > 0) sum += rows[(y-1)*a.w + x];
+            if(y < a.h - 1) sum += rows[(y+1)*a.w + x];
+            a.histogram[y*a.w + x] = sum;
+        }
+    }
+    free(rows);
+    return a;
+}
+
+circle* hough_circle_detect(image m, image edges, int min_radius, int max_radius, int threshold, int* num_circles)
+{
+    // Require a binary edge image and a source image of the same size
+    if (!edges.data || edges.c != 1 || !m.data || m.w != edges.w || m.h != edges.h) {
+        *num_circles = 0;
+        return 0;
+    }
+    if(min_radius < 1) min_radius = 1;
+    if(max_radius < min_radius) max_radius = min_radius;
+    if(threshold < 1) threshold = max_radius - min_radius + 1;
+
+    accumulator a = hough_circle_transform(m, edges, min_radius, max_radius);
+    int num_peaks;
+    int* peaks = find_accumulator_peaks(a, threshold, 0, &num_peaks);
+
+    // estimate the radius of every center from the distances to the surrounding edge pixels
+    circle* candidates = calloc(num_peaks, sizeof(circle));
+    #pragma omp parallel
+    {
+        unsigned int* radii = calloc(max_radius + 2, sizeof(unsigned int));
+        #pragma omp for schedule(dynamic)
+        for(int i = 0; i < num_peaks; ++i) {
+            int cx = peaks[i] % a.w, cy = peaks[i] / a.w;
+            memset(radii, 0, (max_radius + 2)*sizeof(unsigned int));
+            int y0 = MAX(0, cy - max_radius), y1 = MIN(edges.h - 1, cy + max_radius);
+            int x0 = MAX(0, cx - max_radius), x1 = MIN(edges.w - 1, cx + max_radius);
+            for(int y = y0; y <= y1; ++y) {
+                for(int x = x0; x <= x1; ++x) {
+                    if(edges.data[y*edges.w + x] != 1.f) continue;
+                    int r = (int)roundf(sqrtf((x - cx)*(x - cx) + (y - cy)*(y - cy)));
+                    if(r >= min_radius && r <= max_radius) ++radii[r];
+                }
+            }
+            // a full circle of radius r has about 2*pi*r edge pixels, so compare the fraction of
+            // the circumference that is covered instead of raw counts, which favor large radii
+            int best_r = min_radius;
+            float best_count = 0;
+            for(int r = min_radius; r <= max_radius; ++r) {
+                float count = (radii[r-1] + radii[r] + radii[r+1]) / (float)r;
+                if(count > best_count) {
+                    best_count = count;
+                    best_r = r;
+                }
+            }
+            candidates[i].x = cx, candidates[i].y = cy;
+            candidates[i].r = best_r;
+            candidates[i].votes = (int)a.histogram[peaks[i]];
+        }
+        free(radii);
+    }
+
+    circle* circles = 0;
+    for(int i = 0; i < num_peaks; ++i) {
+        sb_push(circles, candidates[i]);
+    }
+    free(candidates);
+    free(peaks);
+    free(a.histogram);
+    *num_circles = (int)sb_count(circles);
+    return circles;
+}
+
+void draw_hough_circles(image* m, circle* circles, int num_circles, float r, float g, float b)
+{
+    #pragma omp parallel for
+    for(int i = 0; i < num_circles; ++i) {
+        circle c = circles[i];
+        draw_circle_thickness(m, c.x, c.y, c.r, 3, r, g, b);
+    }
+}
+
 void draw_hough_lines(image* m, line* lines, int num_lines, float r, float g, float b)
 {
     #pragma omp parallel for
@@ -99,3 +513,13 @@ void draw_hough_lines(image* m, line* lines, int num_lines, float r, float g, fl
         draw_line(m, l.start.x, l.start.y, l.end.x, l.end.y, r, g, b);
     }
 }
+
+void free_lines(line* lines)
+{
+    sb_free(lines);
+}
+
+void free_circles(circle* circles)
+{
+    sb_free(circles);
+}
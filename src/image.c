@@ -106,6 +106,7 @@ int save_image_png(image m, const char* filename)
     sprintf(buffer, "%s.png", filename);
     unsigned char* pixels = get_image_data_hwc(m);
     int success = stbi_write_png(buffer, m.w, m.h, m.c, pixels, m.w*m.c);
+    free(pixels);
     if(!success) fprintf(stderr, "Failed to write image %s\n", buffer);
     return success;
 }
@@ -116,6 +117,7 @@ int save_image_jpg(image m, const char* filename, int quality)
     sprintf(buffer, "%s.jpg", filename);
     unsigned char* pixels = get_image_data_hwc(m);
     int success = stbi_write_jpg(buffer, m.w, m.h, m.c, pixels, quality);
+    free(pixels);
     if(!success) fprintf(stderr, "Failed to write image %s\n", buffer);
     return success;
 }
@@ -523,6 +525,29 @@ image bilinear_resize(image m, int w, int h)
     return out;
 }
 
+image box_downscale(image m, int factor)
+{
+    factor = clamp(factor, 1, MIN(m.w, m.h));
+    const int w = m.w / factor, h = m.h / factor;
+    const float norm = 1.f / (factor*factor);
+    image out = make_image(w, h, m.c);
+    #pragma omp parallel for
+    for(int i = 0; i < m.c*h; ++i) {
+        int k = i / h, y = i % h;
+        float* row = out.data + (size_t)i*w;
+        for(int dy = 0; dy < factor; ++dy) {
+            const float* in = m.data + ((size_t)k*m.h + y*factor + dy)*m.w;
+            for(int x = 0; x < w; ++x) {
+                float sum = 0;
+                for(int dx = 0; dx < factor; ++dx) sum += in[x*factor + dx];
+                row[x] += sum;
+            }
+        }
+        for(int x = 0; x < w; ++x) row[x] *= norm;
+    }
+    return out;
+}
+
 image rotate_image(image m, float rad)
 {
     int cx = m.w / 2, cy = m.h / 2;
@@ -0,0 +1,318 @@
+#include "kdtree.h"
+
+#include "utils.h"
+#include "stretchy_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#define KD_LEAF_SIZE 8  // leaves are split once they hold twice as many descriptors
+#define KD_RAND_DIMS 5  // split dimension is picked among this many highest variance dimensions
+#define KD_SAMPLES 128  // descriptors sampled for the split statistics of a node
+
+// A branch not taken during a search.
+// float bound: lower bound of the distance to any descriptor in the branch.
+// int tree, node: the root of the branch.
+typedef struct {
+    float bound;
+    int tree, node;
+} kd_branch;
+
+// Per thread search state.
+// kd_branch* heap: min heap of branches on bound, with size entries in use out of capacity.
+// int* visited: stamp of the last query that compared every descriptor, so that trees do not repeat work.
+// int stamp: the current query.
+// int checks: descriptors compared by the current query.
+typedef struct {
+    kd_branch* heap;
+    int size, capacity;
+    int* visited;
+    int stamp, checks;
+} kd_search;
+
+kd_forest make_kd_forest(int d, int num_trees, int checks, distance_metric metric)
+{
+    kd_forest f = {0};
+    f.points = make_descriptor_set(0, d);
+    f.num_trees = num_trees < 1 ? 1 : num_trees;
+    f.checks = checks;
+    f.metric = metric;
+    f.trees = calloc(f.num_trees, sizeof(kd_node*));
+    f.seed = 2463534242u;
+    return f;
+}
+
+static void free_kd_tree(kd_node** nodes)
+{
+    for(int i = 0; i < sb_count(*nodes); ++i) sb_free((*nodes)[i].bucket);
+    sb_free(*nodes);
+    *nodes = NULL;
+}
+
+void free_kd_forest(kd_forest* f)
+{
+    for(int t = 0; t < f->num_trees; ++t) free_kd_tree(&f->trees[t]);
+    free(f->trees);
+    free_descriptor_set(&f->points);
+    f->trees = NULL;
+    f->capacity = f->built = 0;
+}
+
+// Picks a split dimension and value for the descriptors idx[0..n-1].
+// returns: 0 if all sampled descriptors are equal and the node should stay a leaf.
+static int choose_split(descriptor_set s, const int* idx, int n, unsigned int* seed, int* dim, float* split)
+{
+    const int d = s.d, samples = MIN(n, KD_SAMPLES);
+    float* mean = calloc(d, sizeof(float));
+    float* var = calloc(d, sizeof(float));
+    for(int i = 0; i < samples; ++i) {
+        const float* x = descriptor_row(s, idx[(long)i*n/samples]);
+        for(int k = 0; k < d; ++k) mean[k] += x[k];
+    }
+    for(int k = 0; k < d; ++k) mean[k] /= samples;
+    for(int i = 0; i < samples; ++i) {
+        const float* x = descriptor_row(s, idx[(long)i*n/samples]);
+        for(int k = 0; k < d; ++k) var[k] += (x[k] - mean[k])*(x[k] - mean[k]);
+    }
+
+    // keep the dimensions with the highest variance, sorted descending
+    int top[KD_RAND_DIMS], num_top = 0;
+    for(int k = 0; k < d; ++k) {
+        if(num_top < KD_RAND_DIMS) top[num_top++] = k;
+        else if(var[k] > var[top[num_top-1]]) top[num_top-1] = k;
+        else continue;
+        for(int j = num_top - 1; j > 0 && var[top[j]] > var[top[j-1]]; --j) {
+            int tmp = top[j]; top[j] = top[j-1]; top[j-1] = tmp;
+        }
+    }
+    while(num_top > 1 && var[top[num_top-1]] <= 0) num_top--;
+
+    *dim = top[xorshift32(seed) % num_top];
+    *split = mean[*dim];
+    int ok = var[*dim] > 0;
+    free(mean); free(var);
+    return ok;
+}
+
+// Partitions idx[0..n-1] into values < split followed by the others.
+// returns: the number of values < split.
+static int partition(descriptor_set s, int* idx, int n, int dim, float split)
+{
+    int lo = 0, hi = n - 1;
+    while(lo <= hi) {
+        if(descriptor_row(s, idx[lo])[dim] < split) lo++;
+        else {
+            int tmp = idx[lo]; idx[lo] = idx[hi]; idx[hi] = tmp;
+            hi--;
+        }
+    }
+    return lo;
+}
+
+static int push_leaf(kd_node** nodes, const int* idx, int n)
+{
+    kd_node leaf = {-1, 0, -1, -1, NULL};
+    if(n) {
+        int* b = sb_add(leaf.bucket, n);
+        memcpy(b, idx, n*sizeof(int));
+    }
+    sb_push(*nodes, leaf);
+    return sb_count(*nodes) - 1;
+}
+
+// Builds the subtree of idx[0..n-1], reordering idx.
+// returns: the index of its root in nodes.
+static int build_kd_node(kd_node** nodes, descriptor_set s, int* idx, int n, unsigned int* seed)
+{
+    int dim;
+    float split;
+    if(n <= KD_LEAF_SIZE || !choose_split(s, idx, n, seed, &dim, &split)) return push_leaf(nodes, idx, n);
+    int nl = partition(s, idx, n, dim, split);
+    if(nl == 0 || nl == n) return push_leaf(nodes, idx, n);
+
+    kd_node inner = {dim, split, -1, -1, NULL};
+    sb_push(*nodes, inner);
+    int ni = sb_count(*nodes) - 1;
+    int left = build_kd_node(nodes, s, idx, nl, seed);
+    int right = build_kd_node(nodes, s, idx + nl, n - nl, seed);
+    (*nodes)[ni].left = left, (*nodes)[ni].right = right;
+    return ni;
+}
+
+// Adds descriptor i to the leaf it falls in, and splits the leaf in two once it is full.
+static void insert_kd_node(kd_node** nodes, descriptor_set s, int i, unsigned int* seed)
+{
+    const float* x = descriptor_row(s, i);
+    int ni = 0;
+    while((*nodes)[ni].dim >= 0) {
+        ni = x[(*nodes)[ni].dim] < (*nodes)[ni].split ? (*nodes)[ni].left : (*nodes)[ni].right;
+    }
+    sb_push((*nodes)[ni].bucket, i);
+
+    int* bucket = (*nodes)[ni].bucket;
+    int n = sb_count(bucket), dim;
+    float split;
+    if(n <= 2*KD_LEAF_SIZE || !choose_split(s, bucket, n, seed, &dim, &split)) return;
+    int nl = partition(s, bucket, n, dim, split);
+    if(nl == 0 || nl == n) return;
+
+    int left = push_leaf(nodes, bucket, nl);
+    int right = push_leaf(nodes, bucket + nl, n - nl);
+    kd_node* node = *nodes + ni;
+    sb_free(node->bucket);
+    node->bucket = NULL;
+    node->dim = dim, node->split = split;
+    node->left = left, node->right = right;
+}
+
+// makes room for n descriptors in total, keeping the current ones.
+static void reserve_kd_forest(kd_forest* f, int n)
+{
+    if(n <= f->capacity) return;
+    int capacity = MAX(n, MAX(2*f->capacity, 256));
+    descriptor_set grown = make_descriptor_set(capacity, f->points.d);
+    int old = f->points.n;
+    if(old) {
+        memcpy(grown.data, f->points.data, (size_t)old*f->points.stride*sizeof(float));
+        memcpy(grown.p, f->points.p, old*sizeof(point));
+        memcpy(grown.score, f->points.score, old*sizeof(float));
+        memcpy(grown.level, f->points.level, old*sizeof(int));
+    }
+    free_descriptor_set(&f->points);
+    f->points = grown;
+    f->points.n = old;
+    f->capacity = capacity;
+}
+
+void kd_forest_add(kd_forest* f, descriptor_set s)
+{
+    if(s.n == 0 || s.type != FLOAT_DESCRIPTOR || s.d != f->points.d) return;
+    int first = f->points.n;
+    reserve_kd_forest(f, first + s.n);
+    memcpy(descriptor_row(f->points, first), s.data, (size_t)s.n*s.stride*sizeof(float));
+    memcpy(f->points.p + first, s.p, s.n*sizeof(point));
+    memcpy(f->points.score + first, s.score, s.n*sizeof(float));
+    memcpy(f->points.level + first, s.level, s.n*sizeof(int));
+    f->points.n += s.n;
+
+    const int rebuild = f->points.n >= 2*f->built;
+    const descriptor_set points = f->points;
+    unsigned int seed = xorshift32(&f->seed);
+    #pragma omp parallel for
+    for(int t = 0; t < f->num_trees; ++t) {
+        unsigned int tree_seed = seed ^ (0x9e3779b9u*(t + 1));
+        if(!tree_seed) tree_seed = 1;
+        if(rebuild) {
+            int* idx = malloc(points.n*sizeof(int));
+            for(int i = 0; i < points.n; ++i) idx[i] = i;
+            free_kd_tree(&f->trees[t]);
+            build_kd_node(&f->trees[t], points, idx, points.n, &tree_seed);
+            free(idx);
+        }
+        else {
+            for(int i = first; i < points.n; ++i) insert_kd_node(&f->trees[t], points, i, &tree_seed);
+        }
+    }
+    if(rebuild) f->built = f->points.n;
+}
+
+static void push_branch(kd_search* s, kd_branch b)
+{
+    if(s->size == s->capacity) {
+        s->capacity = s->capacity ? 2*s->capacity : 64;
+        s->heap = realloc(s->heap, s->capacity*sizeof(kd_branch));
+    }
+    int i = s->size++;
+    s->heap[i] = b;
+    while(i > 0 && s->heap[(i-1)/2].bound > s->heap[i].bound) {
+        kd_branch tmp = s->heap[i]; s->heap[i] = s->heap[(i-1)/2]; s->heap[(i-1)/2] = tmp;
+        i = (i-1)/2;
+    }
+}
+
+static kd_branch pop_branch(kd_search* s)
+{
+    kd_branch top = s->heap[0];
+    int n = --s->size, i = 0;
+    s->heap[0] = s->heap[n];
+    for(;;) {
+        int l = 2*i + 1, r = l + 1, m = i;
+        if(l < n && s->heap[l].bound < s->heap[m].bound) m = l;
+        if(r < n && s->heap[r].bound < s->heap[m].bound) m = r;
+        if(m == i) break;
+        kd_branch tmp = s->heap[i]; s->heap[i] = s->heap[m]; s->heap[m] = tmp;
+        i = m;
+    }
+    return top;
+}
+
+// Descends from a node to the leaf of q, queueing the branches not taken, then compares q to the leaf.
+static void search_kd_node(kd_forest f, kd_search* s, const float* q, int tree, int ni, float bound, int k, int* idx, float* dist)
+{
+    const kd_node* nodes = f.trees[tree];
+    const int l2 = f.metric == DISTANCE_L2;
+    while(nodes[ni].dim >= 0) {
+        float diff = q[nodes[ni].dim] - nodes[ni].split;
+        kd_branch far = {bound + (l2 ? diff*diff : fabsf(diff)), tree, diff < 0 ? nodes[ni].right : nodes[ni].left};
+        if(far.bound < dist[k-1]) push_branch(s, far);
+        ni = diff < 0 ? nodes[ni].left : nodes[ni].right;
+    }
+    const int* bucket = nodes[ni].bucket;
+    for(int b = 0; b < sb_count(bucket); ++b) {
+        int i = bucket[b];
+        if(s->visited[i] == s->stamp) continue;
+        s->visited[i] = s->stamp;
+        s->checks++;
+        float d = descriptor_distance(q, descriptor_row(f.points, i), f.points.stride, f.metric);
+        if(d >= dist[k-1]) continue;
+        int j = k - 1;
+        for(; j > 0 && dist[j-1] > d; --j) {
+            dist[j] = dist[j-1], idx[j] = idx[j-1];
+        }
+        dist[j] = d, idx[j] = i;
+    }
+}
+
+void kd_forest_knn(kd_forest f, descriptor_set q, int k, int* indexes, float* dists)
+{
+    #pragma omp parallel
+    {
+        kd_search s = {NULL, 0, 0, calloc(f.points.n ? f.points.n : 1, sizeof(int)), 0, 0};
+        #pragma omp for schedule(dynamic, 16)
+        for(int j = 0; j < q.n; ++j) {
+            const float* x = descriptor_row(q, j);
+            int* idx = indexes + (size_t)j*k;
+            float* dist = dists + (size_t)j*k;
+            for(int i = 0; i < k; ++i) idx[i] = -1, dist[i] = FLT_MAX;
+            if(f.points.n == 0) continue;
+
+            s.stamp++, s.checks = 0;
+            s.size = 0;
+            for(int t = 0; t < f.num_trees; ++t) search_kd_node(f, &s, x, t, 0, 0.f, k, idx, dist);
+            while(s.size && (s.checks < f.checks || idx[k-1] < 0)) {
+                kd_branch b = pop_branch(&s);
+                if(b.bound >= dist[k-1]) break;
+                search_kd_node(f, &s, x, b.tree, b.node, b.bound, k, idx, dist);
+            }
+            if(f.metric == DISTANCE_L2) {
+                for(int i = 0; i < k; ++i) if(idx[i] >= 0) dist[i] = sqrtf(dist[i]);
+            }
+        }
+        free(s.heap);
+        free(s.visited);
+    }
+}
+
+void kd_forest_nearest(kd_forest f, descriptor_set q, nearest_pair* nn)
+{
+    int* idx = malloc((q.n ? q.n : 1)*2*sizeof(int));
+    float* dist = malloc((q.n ? q.n : 1)*2*sizeof(float));
+    kd_forest_knn(f, q, 2, idx, dist);
+    for(int j = 0; j < q.n; ++j) {
+        nearest_pair p = {idx[2*j], idx[2*j+1], dist[2*j], dist[2*j+1]};
+        nn[j] = p;
+    }
+    free(idx); free(dist);
+}
@@ -0,0 +1,226 @@
+#include "keypoints.h"
+
+#include "utils.h"
+
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+
+#define REFINE_BATCH 64
+
+// a is weaker than b: lower key, or the same key and later in the input
+static inline int weaker(const float* key, int a, int b)
+{
+    return key[a] < key[b] || (key[a] == key[b] && a > b);
+}
+
+static void heap_sift_up(int* heap, int i, const float* key)
+{
+    while(i > 0 && weaker(key, heap[i], heap[(i-1)/2])) {
+        int tmp = heap[i]; heap[i] = heap[(i-1)/2]; heap[(i-1)/2] = tmp;
+        i = (i-1)/2;
+    }
+}
+
+static void heap_sift_down(int* heap, int n, int i, const float* key)
+{
+    for(;;) {
+        int l = 2*i + 1, r = l + 1, m = i;
+        if(l < n && weaker(key, heap[l], heap[m])) m = l;
+        if(r < n && weaker(key, heap[r], heap[m])) m = r;
+        if(m == i) return;
+        int tmp = heap[i]; heap[i] = heap[m]; heap[m] = tmp;
+        i = m;
+    }
+}
+
+// offers index i to a min heap that keeps the k strongest indexes seen
+static inline void heap_offer(int* heap, int* size, int k, int i, const float* key)
+{
+    if(*size < k) {
+        heap[(*size)++] = i;
+        heap_sift_up(heap, *size - 1, key);
+    }
+    else if(weaker(key, heap[0], i)) {
+        heap[0] = i;
+        heap_sift_down(heap, k, 0, key);
+    }
+}
+
+// moves the keypoints marked in keep to the start of p and score, in order.
+static int compact_keypoints(point* p, float* score, int n, const char* keep)
+{
+    int count = 0;
+    for(int i = 0; i < n; ++i) {
+        if(!keep[i]) continue;
+        p[count] = p[i];
+        score[count] = score[i];
+        count++;
+    }
+    return count;
+}
+
+// keeps the k indexes with the largest key
+static int retain_best_by_key(point* p, float* score, int n, int k, const float* key)
+{
+    if(k <= 0 || n <= k) return n;
+    int* heap = malloc(k*sizeof(int)), size = 0;
+    for(int i = 0; i < n; ++i) heap_offer(heap, &size, k, i, key);
+    char* keep = calloc(n, 1);
+    for(int i = 0; i < size; ++i) keep[heap[i]] = 1;
+    int count = compact_keypoints(p, score, n, keep);
+    free(heap); free(keep);
+    return count;
+}
+
+int retain_best_keypoints(point* p, float* score, int n, int target)
+{
+    return retain_best_by_key(p, score, n, target, score);
+}
+
+int grid_bucket_keypoints(point* p, float* score, int n, int w, int h, int cell, int per_cell)
+{
+    if(cell <= 0 || per_cell <= 0 || n == 0) return n;
+    int cols = (w + cell - 1) / cell, rows = (h + cell - 1) / cell;
+    int* heaps = malloc((size_t)cols*rows*per_cell*sizeof(int));
+    int* sizes = calloc(cols*rows, sizeof(int));
+    for(int i = 0; i < n; ++i) {
+        int cx = clamp(p[i].x / cell, 0, cols - 1), cy = clamp(p[i].y / cell, 0, rows - 1);
+        int c = cy*cols + cx;
+        heap_offer(heaps + (size_t)c*per_cell, sizes + c, per_cell, i, score);
+    }
+    char* keep = calloc(n, 1);
+    for(int c = 0; c < cols*rows; ++c) {
+        for(int j = 0; j < sizes[c]; ++j) keep[heaps[(size_t)c*per_cell + j]] = 1;
+    }
+    int count = compact_keypoints(p, score, n, keep);
+    free(heaps); free(sizes); free(keep);
+    return count;
+}
+
+static inline float coord(const point* p, int i, int axis)
+{
+    return axis ? p[i].y : p[i].x;
+}
+
+// partially sorts idx[lo..hi) on one axis so that idx[nth] is in its sorted place.
+static void select_nth(int* idx, int lo, int hi, int nth, int axis, const point* p)
+{
+    hi--;
+    while(lo < hi) {
+        float pivot = coord(p, idx[(lo + hi)/2], axis);
+        int i = lo, j = hi;
+        while(i <= j) {
+            while(coord(p, idx[i], axis) < pivot) i++;
+            while(coord(p, idx[j], axis) > pivot) j--;
+            if(i <= j) {
+                int tmp = idx[i]; idx[i] = idx[j]; idx[j] = tmp;
+                i++, j--;
+            }
+        }
+        if(nth <= j) hi = j;
+        else if(nth >= i) lo = i;
+        else return;
+    }
+}
+
+// Implicit 2d tree over idx[lo..hi): the median on axis sits at the middle, halves alternate axes.
+// max_score[mid] is the highest score in the range, to skip subtrees without stronger keypoints.
+static void build_score_tree(int* idx, float* max_score, int lo, int hi, int axis, const point* p, const float* score)
+{
+    if(lo >= hi) return;
+    int mid = (lo + hi)/2;
+    select_nth(idx, lo, hi, mid, axis, p);
+    build_score_tree(idx, max_score, lo, mid, !axis, p, score);
+    build_score_tree(idx, max_score, mid + 1, hi, !axis, p, score);
+    float m = score[idx[mid]];
+    if(lo < mid) m = MAX(m, max_score[(lo + mid)/2]);
+    if(mid + 1 < hi) m = MAX(m, max_score[(mid + 1 + hi)/2]);
+    max_score[mid] = m;
+}
+
+// squared distance from q to the nearest keypoint with a score above thresh, at most best.
+static float nearest_stronger(const int* idx, const float* max_score, int lo, int hi, int axis,
+                              const point* p, const float* score, point q, float thresh, float best)
+{
+    if(lo >= hi) return best;
+    int mid = (lo + hi)/2;
+    if(max_score[mid] <= thresh) return best;
+    int j = idx[mid];
+    if(score[j] > thresh) {
+        float dx = p[j].x - q.x, dy = p[j].y - q.y;
+        best = MIN(best, dx*dx + dy*dy);
+    }
+    float diff = axis ? q.y - p[j].y : q.x - p[j].x;
+    if(diff < 0) {
+        best = nearest_stronger(idx, max_score, lo, mid, !axis, p, score, q, thresh, best);
+        if(diff*diff < best) best = nearest_stronger(idx, max_score, mid + 1, hi, !axis, p, score, q, thresh, best);
+    }
+    else {
+        best = nearest_stronger(idx, max_score, mid + 1, hi, !axis, p, score, q, thresh, best);
+        if(diff*diff < best) best = nearest_stronger(idx, max_score, lo, mid, !axis, p, score, q, thresh, best);
+    }
+    return best;
+}
+
+int anms_keypoints(point* p, float* score, int n, int target, float robust)
+{
+    if(target <= 0 || n <= target) return n;
+    if(robust <= 0 || robust > 1) robust = 1;
+    int* idx = malloc(n*sizeof(int));
+    float* max_score = malloc(n*sizeof(float));
+    float* radius = malloc(n*sizeof(float));
+    for(int i = 0; i < n; ++i) idx[i] = i;
+    build_score_tree(idx, max_score, 0, n, 0, p, score);
+
+    #pragma omp parallel for schedule(dynamic, 64)
+    for(int i = 0; i < n; ++i) {
+        // dividing a negative score by robust would let weaker keypoints suppress it
+        float thresh = score[i] >= 0 ? score[i] / robust : score[i] * robust;
+        radius[i] = nearest_stronger(idx, max_score, 0, n, 0, p, score, p[i], thresh, FLT_MAX);
+    }
+    int count = retain_best_by_key(p, score, n, target, radius);
+    free(idx); free(max_score); free(radius);
+    return count;
+}
+
+// offsets of the quadratic peak around the pixels of a batch, from their 3x3 responses v[k][i]
+static void quadratic_peaks(float v[9][REFINE_BATCH], int n, float* ox, float* oy)
+{
+    #pragma omp simd
+    for(int i = 0; i < n; ++i) {
+        float dx = .5f*(v[5][i] - v[3][i]);
+        float dy = .5f*(v[7][i] - v[1][i]);
+        float dxx = v[5][i] - 2.f*v[4][i] + v[3][i];
+        float dyy = v[7][i] - 2.f*v[4][i] + v[1][i];
+        float dxy = .25f*(v[8][i] - v[6][i] - v[2][i] + v[0][i]);
+        float det = dxx*dyy - dxy*dxy;
+        // a maximum needs a negative definite hessian
+        int peak = dxx < 0 && det > 0;
+        float inv = peak ? 1.f / det : 0;
+        ox[i] = fminf(fmaxf(-(dyy*dx - dxy*dy)*inv, -.5f), .5f);
+        oy[i] = fminf(fmaxf(-(dxx*dy - dxy*dx)*inv, -.5f), .5f);
+    }
+}
+
+void refine_keypoints(image response, point* p, int n)
+{
+    const int w = response.w, h = response.h;
+    #pragma omp parallel for schedule(dynamic)
+    for(int b = 0; b < n; b += REFINE_BATCH) {
+        int count = MIN(REFINE_BATCH, n - b);
+        float v[9][REFINE_BATCH], ox[REFINE_BATCH], oy[REFINE_BATCH];
+        for(int i = 0; i < count; ++i) {
+            int x = (int)lrintf(p[b + i].x), y = (int)lrintf(p[b + i].y);
+            for(int k = 0; k < 9; ++k) {
+                int xk = clamp(x + k%3 - 1, 0, w - 1), yk = clamp(y + k/3 - 1, 0, h - 1);
+                v[k][i] = response.data[yk*w + xk];
+            }
+        }
+        quadratic_peaks(v, count, ox, oy);
+        for(int i = 0; i < count; ++i) {
+            p[b + i].x = lrintf(p[b + i].x) + ox[i];
+            p[b + i].y = lrintf(p[b + i].y) + oy[i];
+        }
+    }
+}
@@ -1,17 +1,32 @@
 #include "matrix.h"
+#include "homography.h"
+#include "solve.h"
+#include "utils.h"
 
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
+
+#define GEMM_MC 64 // rows of op(a) per block
+#define GEMM_KC 128 // inner dimension per block
+#define GEMM_NC 512 // columns of op(b) per packed panel
+#define GEMM_PARALLEL_SIZE (64*64*64) // multiply-adds from which gemm splits over threads
 
 matrix make_matrix(int rows, int cols)
 {
     matrix m;
     m.rows = rows, m.cols = cols;
-    m.data = calloc(m.rows, sizeof(float*));
-    for(int i = 0; i < m.rows; ++i) {
-        m.data[i] = calloc(m.cols, sizeof(float));
+    m.stride = (cols + 7) & ~7;
+    // row pointers first, then the values aligned to 32 bytes
+    size_t header = ((size_t)rows*sizeof(float*) + 31) & ~(size_t)31;
+    char* block = aligned_calloc(32, header + (size_t)rows*m.stride*sizeof(float));
+    m.data = (float**)block;
+    if(!block) return m;
+    float* values = (float*)(block + header);
+    for(int i = 0; i < rows; ++i) {
+        m.data[i] = values + (size_t)i*m.stride;
     }
     return m;
 }
@@ -19,10 +34,7 @@ matrix make_matrix(int rows, int cols)
 matrix make_identity(int n)
 {
     matrix m = make_matrix(n, n);
-    m.rows = n, m.cols = n;
-    m.data = calloc(n, sizeof(float*));
     for(int i = 0; i < n; ++i) {
-        m.data[i] = calloc(n, sizeof(float));
         m.data[i][i] = 1.f;
     }
     return m;
@@ -30,61 +42,101 @@ matrix make_identity(int n)
 
 matrix make_translation_homography(float dx, float dy)
 {
-    matrix H = make_identity(3);
-    H.data[0][2] = dx;
-    H.data[1][2] = dy;
-    return H;
+    return hom3_to_matrix(hom3_translation(dx, dy));
 }
 
 matrix copy_matrix(matrix m)
 {
-    matrix c;
-    c.rows = m.rows, c.cols = m.cols;
-    c.data = calloc(c.rows, sizeof(float*));
+    matrix c = make_matrix(m.rows, m.cols);
     for(int i = 0; i < m.rows; ++i) {
-        c.data[i] = calloc(c.cols, sizeof(float));
-        for(int j = 0; j < m.cols; ++j) {
-            c.data[i][j] = m.data[i][j];
-        }
+        memcpy(c.data[i], m.data[i], m.cols*sizeof(float));
     }
     return c;
 }
 
 void free_matrix(matrix* m)
 {
-    if (m->data) {
-        for(int i = 0; i < m->rows; ++i) {
-            free(m->data[i]);
-        }
-        free(m->data);
-    }
+    free(m->data);
+    m->data = NULL;
 }
 
 matrix transpose_matrix(matrix m)
 {
-    matrix t;
-    t.rows = m.cols, t.cols = m.rows;
-    t.data = calloc(t.rows, sizeof(float*));
-    for(int i = 0; i < t.rows; ++i) {
-        t.data[i] = calloc(t.cols, sizeof(float));
-        for(int j = 0; j < t.cols; ++j) {
-            t.data[i][j] = m.data[j][i];
+    const int block = 32;
+    matrix t = make_matrix(m.cols, m.rows);
+    for(int i0 = 0; i0 < m.rows; i0 += block) {
+        for(int j0 = 0; j0 < m.cols; j0 += block) {
+            for(int i = i0; i < MIN(i0 + block, m.rows); ++i) {
+                for(int j = j0; j < MIN(j0 + block, m.cols); ++j) {
+                    t.data[j][i] = m.data[i][j];
+                }
+            }
         }
     }
     return t;
 }
 
-matrix multiply_matrix(matrix a, matrix b)
+// Copies the kc x nc block of op(b) at k0, j0 into a row major panel, scaling by alpha.
+static void pack_panel(int tb, matrix b, int k0, int kc, int j0, int nc, float alpha, float* panel)
 {
-    assert(a.cols == b.rows);
-    matrix result = make_matrix(a.rows, b.cols);
-    for(int i = 0; i < result.rows; ++i) {
-        for(int j = 0; j < result.cols; ++j) {
-            for(int k = 0; k < a.cols; ++k) {
-                result.data[i][j] += a.data[i][k]*b.data[k][j];
+    if(!tb) {
+        for(int k = 0; k < kc; ++k) {
+            const float* row = b.data[k0 + k] + j0;
+            float* out = panel + k*nc;
+            for(int j = 0; j < nc; ++j) out[j] = alpha*row[j];
+        }
+    }
+    else {
+        for(int j = 0; j < nc; ++j) {
+            const float* row = b.data[j0 + j] + k0;
+            for(int k = 0; k < kc; ++k) panel[k*nc + j] = alpha*row[k];
+        }
+    }
+}
+
+// c[i0.., j0..] += op(a)[i0.., k0..] * panel, one row of c at a time so that the column loop vectorizes
+static void gemm_block(int ta, matrix a, int i0, int mc, int k0, int kc, const float* panel, int j0, int nc, matrix c)
+{
+    for(int i = i0; i < i0 + mc; ++i) {
+        float* out = c.data[i] + j0;
+        for(int k = 0; k < kc; ++k) {
+            float aik = ta ? a.data[k0 + k][i] : a.data[i][k0 + k];
+            const float* p = panel + k*nc;
+            #pragma omp simd
+            for(int j = 0; j < nc; ++j) out[j] += aik*p[j];
+        }
+    }
+}
+
+void gemm(int ta, int tb, float alpha, matrix a, matrix b, float beta, matrix c)
+{
+    const int M = ta ? a.cols : a.rows, K = ta ? a.rows : a.cols, N = tb ? b.rows : b.cols;
+    assert(K == (tb ? b.cols : b.rows) && c.rows == M && c.cols == N);
+    for(int i = 0; i < M; ++i) {
+        float* row = c.data[i];
+        if(beta == 0) memset(row, 0, N*sizeof(float));
+        else if(beta != 1) for(int j = 0; j < N; ++j) row[j] *= beta;
+    }
+    float* panel = malloc((size_t)GEMM_KC*GEMM_NC*sizeof(float));
+    for(int j0 = 0; j0 < N; j0 += GEMM_NC) {
+        int nc = MIN(GEMM_NC, N - j0);
+        for(int k0 = 0; k0 < K; k0 += GEMM_KC) {
+            int kc = MIN(GEMM_KC, K - k0);
+            pack_panel(tb, b, k0, kc, j0, nc, alpha, panel);
+            #pragma omp parallel for schedule(dynamic) if((double)M*N*K >= GEMM_PARALLEL_SIZE)
+            for(int i0 = 0; i0 < M; i0 += GEMM_MC) {
+                gemm_block(ta, a, i0, MIN(GEMM_MC, M - i0), k0, kc, panel, j0, nc, c);
             }
         }
     }
+    free(panel);
+}
+
+matrix multiply_matrix(matrix a, matrix b)
+{
+    assert(a.cols == b.rows);
+    matrix result = make_matrix(a.rows, b.cols);
+    gemm(0, 0, 1.f, a, b, 0.f, result);
     return result;
 }
 
@@ -167,12 +219,15 @@ matrix invert_matrix(matrix m)
 matrix least_squares(matrix X, matrix Y)
 {
     matrix empty = { 0 };
-    matrix Xt = transpose_matrix(X);
-    matrix XtX = multiply_matrix(Xt, X);
-    matrix XtXinv = invert_matrix(XtX);
-    if(!XtXinv.data) return empty;
-    matrix a = multiply_matrix(XtXinv, Xt);
-    matrix beta = multiply_matrix(a, Y);
-    free_matrix(&Xt); free_matrix(&XtX); free_matrix(&XtXinv); free_matrix(&a);
+    matrix A = copy_matrix(X), B = copy_matrix(Y);
+    if(X.rows < X.cols || !qr_solve(A, B)) {
+        free_matrix(&A); free_matrix(&B);
+        return empty;
+    }
+    matrix beta = make_matrix(X.cols, Y.cols);
+    for(int i = 0; i < X.cols; ++i) {
+        memcpy(beta.data[i], B.data[i], Y.cols*sizeof(float));
+    }
+    free_matrix(&A); free_matrix(&B);
     return beta;
 }
@@ -0,0 +1,124 @@
+#include "orb.h"
+
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define ORB_PATCH_RADIUS 15 // radius of the patch the orientation is measured on
+#define ORB_PATTERN_RADIUS 11 // pattern coordinates are clamped to this, so rotated 5x5 boxes stay near the patch
+
+// fixed sampling pattern, x1 y1 x2 y2 for every bit, drawn from an isotropic gaussian as in BRIEF
+static void make_orb_pattern(float* pattern)
+{
+    unsigned int seed = 0x2545f491u;
+    const float sigma = (2*ORB_PATCH_RADIUS + 1) / 5.f;
+    for(int i = 0; i < 4*ORB_BITS; i += 2) {
+        // box-muller transform, one pair of gaussian coordinates per point
+        float u = (xorshift32(&seed) + 1.f) / 4294967296.f;
+        float v = xorshift32(&seed) / 4294967296.f;
+        float r = sigma*sqrtf(-2.f*logf(u));
+        pattern[i] = fmaxf(-ORB_PATTERN_RADIUS, fminf(ORB_PATTERN_RADIUS, r*cosf(2*M_PI*v)));
+        pattern[i+1] = fmaxf(-ORB_PATTERN_RADIUS, fminf(ORB_PATTERN_RADIUS, r*sinf(2*M_PI*v)));
+    }
+}
+
+// mean of the channels
+static float* mean_intensity(image m)
+{
+    float* g = malloc((size_t)m.w*m.h*sizeof(float));
+    #pragma omp parallel for
+    for(int y = 0; y < m.h; ++y) {
+        for(int x = 0; x < m.w; ++x) {
+            float v = 0;
+            for(int c = 0; c < m.c; ++c) v += m.data[(c*m.h + y)*m.w + x];
+            g[y*m.w + x] = v / m.c;
+        }
+    }
+    return g;
+}
+
+// (w+1)x(h+1) integral image, in double so that box sums stay exact on large images
+static double* make_integral(const float* g, int w, int h)
+{
+    const int s = w + 1;
+    double* ii = calloc((size_t)s*(h + 1), sizeof(double));
+    for(int y = 0; y < h; ++y) {
+        double row = 0;
+        for(int x = 0; x < w; ++x) {
+            row += g[y*w + x];
+            ii[(y + 1)*s + x + 1] = ii[y*s + x + 1] + row;
+        }
+    }
+    return ii;
+}
+
+// sum over [x0, x1) x [y0, y1), clipped to the image
+static inline double box_sum(const double* ii, int w, int h, int x0, int y0, int x1, int y1, int* area)
+{
+    x0 = clamp(x0, 0, w), x1 = clamp(x1, 0, w);
+    y0 = clamp(y0, 0, h), y1 = clamp(y1, 0, h);
+    *area = (x1 - x0)*(y1 - y0);
+    const int s = w + 1;
+    return ii[y1*s + x1] - ii[y0*s + x1] - ii[y1*s + x0] + ii[y0*s + x0];
+}
+
+// mean intensity of the 5x5 box around x,y
+static inline float box_mean(const double* ii, int w, int h, int x, int y)
+{
+    int area;
+    double sum = box_sum(ii, w, h, x - 2, y - 2, x + 3, y + 3, &area);
+    return area ? sum / area : 0;
+}
+
+// orientation of the intensity centroid of the disc of radius ORB_PATCH_RADIUS around x,y
+static float centroid_angle(const float* g, int w, int h, int x, int y)
+{
+    const int r = ORB_PATCH_RADIUS;
+    float m10 = 0, m01 = 0;
+    for(int dy = -r; dy <= r; ++dy) {
+        if(y + dy < 0 || y + dy >= h) continue;
+        int half = (int)sqrtf(r*r - dy*dy);
+        int x0 = MAX(-half, -x), x1 = MIN(half, w - 1 - x);
+        const float* row = g + (y + dy)*w + x;
+        float sum = 0, moment = 0;
+        for(int dx = x0; dx <= x1; ++dx) {
+            sum += row[dx];
+            moment += dx*row[dx];
+        }
+        m10 += moment;
+        m01 += dy*sum;
+    }
+    return atan2f(m01, m10);
+}
+
+descriptor_set describe_orb(image m, const point* p, const float* score, int n)
+{
+    descriptor_set s = make_binary_descriptor_set(n, ORB_BITS);
+    memcpy(s.p, p, n*sizeof(point));
+    if(score) memcpy(s.score, score, n*sizeof(float));
+
+    float pattern[4*ORB_BITS];
+    make_orb_pattern(pattern);
+    float* g = mean_intensity(m);
+    double* ii = make_integral(g, m.w, m.h);
+
+    #pragma omp parallel for schedule(dynamic, 16)
+    for(int i = 0; i < n; ++i) {
+        int x = (int)lrintf(p[i].x), y = (int)lrintf(p[i].y);
+        float angle = centroid_angle(g, m.w, m.h, x, y);
+        float c = cosf(angle), sn = sinf(angle);
+        uint64_t* bits = descriptor_bits(s, i);
+        for(int b = 0; b < ORB_BITS; ++b) {
+            const float* q = pattern + 4*b;
+            int x1 = x + (int)lrintf(c*q[0] - sn*q[1]), y1 = y + (int)lrintf(sn*q[0] + c*q[1]);
+            int x2 = x + (int)lrintf(c*q[2] - sn*q[3]), y2 = y + (int)lrintf(sn*q[2] + c*q[3]);
+            if(box_mean(ii, m.w, m.h, x1, y1) < box_mean(ii, m.w, m.h, x2, y2)) {
+                bits[b >> 6] |= 1ull << (b & 63);
+            }
+        }
+    }
+    free(g); free(ii);
+    return s;
+}
@@ -1,22 +1,26 @@
 #include "panorama.h"
 
 #include "utils.h"
+#include "stretchy_buffer.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
+#include <float.h>
 
-static inline float bilinear_interpolate(image m, float x, float y, int c)
-{
-    int lx = (int) floorf(x), ly = (int) floorf(y);
-    float dx = x - lx, dy = y - ly;
-    float interpolated_val = get_pixel(m, x, y, c)*(1-dx)*(1-dy) +
-                             get_pixel(m, x+1, y, c)*dx*(1-dy) +
-                             get_pixel(m, x, y+1, c)*(1-dx)*dy +
-                             get_pixel(m, x+1, y+1, c)*dx*dy;
-    return interpolated_val;
-}
+#define INDEX_MATCH_SIZE 2000 // descriptors in b from which matching searches a k-d forest instead of brute force
+#define INDEX_MATCH_TREES 4
+#define INDEX_MATCH_CHECKS 128
+#define PROJECT_BATCH 256 // points projected at once on the stack
+#define RANSAC_ROUND 64 // hypotheses scored in parallel between two stopping checks
+#define RANSAC_MIN_AREA 1.f // twice the area in pixels of the smallest triangle a sample may span
+#define FINE_WINDOW 128 // side of the full resolution windows coarse-to-fine registration detects corners in
+#define FINE_GRID 6 // most windows across and down the predicted overlap
+#define REFINE_ITERS 10 // most Levenberg-Marquardt steps of refine_homography
+#define REFINE_DELTA .5f // pixels of reprojection error beyond which huber weights fall off
+#define HOMOGRAPHY_MAX_RATIO .1f // largest smallest-to-next singular value ratio of a determined homography
+#define MAX_WARP_GROWTH 16.f // images whose outline grows more than this in the canvas have a broken homography
 
 static inline point make_point(float x, float y)
 {
@@ -24,13 +28,6 @@ static inline point make_point(float x, float y)
     return p;
 }
 
-static inline matrix make_homogenous(point p)
-{
-    matrix h = make_matrix(3, 1);
-    h.data[0][0] = p.x, h.data[1][0] = p.y, h.data[2][0] = 1.f;
-    return h;
-}
-
 // compute L2 distance between two points
 static inline float point_distance(point p, point q)
 {
@@ -64,7 +61,7 @@ static inline image both_images(image a, image b)
 static inline float l1_distance(float* a, float* b, int n)
 {
     float dist = 0;
-    #pragma omp parallel for reduction(+:dist)
+    #pragma omp simd reduction(+:dist)
     for(int i = 0; i < n; ++i) {
         dist += fabsf(a[i] - b[i]);
     }
@@ -93,117 +90,311 @@ static inline image draw_matches(image a, image b, match* matches, int n, int nu
     return both;
 }
 
-static inline void shuffle_matches(match* m, int n)
-{
-    for(int i = n - 1; i > 0; --i){
-        int j = rand() % (i + 1);
-        match tmp = m[i];
-        m[i] = m[j];
-        m[j] = tmp;
-    }
-}
-
 // Apply a projective transformation to a point.
 // matrix H: homography to project point.
 // point p: point to project.
 point project_point(matrix H, point p)
 {
-    matrix c = make_homogenous(p);
-    matrix x = multiply_matrix(H, c);
-    point q = { x.data[0][0] / x.data[2][0], x.data[1][0] / x.data[2][0] };
-    free_matrix(&c); free_matrix(&x);
-    return q;
+    return hom3_project(matrix_to_hom3(H), p);
 }
 
-// Computes homography between two images given matching pixels.
-// returns: matrix representing homography H that maps image a to image b.
-matrix compute_homography(match* matches, int n)
+// Similarity that moves the centroid of n points to the origin and their mean distance to it to sqrt(2),
+// so that the DLT system is well conditioned whatever the image size. Returns 0 if the points coincide.
+static int normalizing_transform(const match* m, int n, int second, hom3* T)
 {
-    // estimate projection parameters
-    matrix M = make_matrix(n*2, 8), b = make_matrix(n*2, 1);
+    double cx = 0, cy = 0, d = 0;
     for(int i = 0; i < n; ++i) {
-        float x = matches[i].p.x, x_proj = matches[i].q.x;
-        float y = matches[i].p.y, y_proj = matches[i].q.y;
-        float data0[8] = { x, y, 1, 0, 0, 0, -x*x_proj, -y*x_proj };
-        float data1[8] = { 0, 0, 0, x, y, 1, -x*y_proj, -y*y_proj };
-        memcpy(*(M.data+2*i), data0, sizeof(data0));
-        memcpy(*(M.data+2*i+1), data1, sizeof(data1));
-        b.data[2*i][0] = x_proj;
-        b.data[2*i+1][0] = y_proj;
+        point p = second ? m[i].q : m[i].p;
+        cx += p.x, cy += p.y;
     }
-    matrix H_hat = least_squares(M, b);
-    free_matrix(&M); free_matrix(&b);
-
-    matrix empty = {0};
-    if(!H_hat.data) return empty;
+    cx /= n, cy /= n;
+    for(int i = 0; i < n; ++i) {
+        point p = second ? m[i].q : m[i].p;
+        d += sqrt((p.x - cx)*(p.x - cx) + (p.y - cy)*(p.y - cy));
+    }
+    if(d <= 0) return 0;
+    float s = sqrt(2.) / (d / n);
+    hom3 S = {{{s, 0, -s*cx}, {0, s, -s*cy}, {0, 0, 1}}};
+    *T = S;
+    return 1;
+}
 
-    matrix H = make_matrix(3, 3);
+// Computes homography between two images given matching pixels, by the normalized DLT:
+// the 9 entries of H are the null vector of the 2n x 9 system in normalized coordinates.
+// hom3* H: set to the homography that maps image a to image b.
+// returns: 1 on success, 0 if the matches do not determine a homography.
+int compute_homography(match* matches, int n, hom3* H)
+{
+    hom3 Tp, Tq, Tq_inv;
+    if(n < 4 || !normalizing_transform(matches, n, 0, &Tp) || !normalizing_transform(matches, n, 1, &Tq)) return 0;
+    hom3_invert(Tq, &Tq_inv);
 
-    for(int i = 0; i < M.cols; ++i) {
-        H.data[i / 3][i % 3] = H_hat.data[i][0];
+    // at least 9 rows, so that 4 matches give a square system with a zero row
+    matrix M = make_matrix(MAX(n*2, 9), 9);
+    for(int i = 0; i < n; ++i) {
+        point p = hom3_project(Tp, matches[i].p), q = hom3_project(Tq, matches[i].q);
+        float x = p.x, y = p.y, x_proj = q.x, y_proj = q.y;
+        float data0[9] = { x, y, 1, 0, 0, 0, -x*x_proj, -y*x_proj, -x_proj };
+        float data1[9] = { 0, 0, 0, x, y, 1, -x*y_proj, -y*y_proj, -y_proj };
+        memcpy(M.data[2*i], data0, sizeof(data0));
+        memcpy(M.data[2*i+1], data1, sizeof(data1));
     }
-    H.data[2][2] = 1;
+    float h[9];
+    float ratio = null_vector(M, h);
+    free_matrix(&M);
+    // collinear points or fewer than 4 independent matches leave more than one solution
+    if(!(ratio < HOMOGRAPHY_MAX_RATIO)) return 0;
 
-    free_matrix(&H_hat);
-    return H;
+    hom3 Hn;
+    for(int i = 0; i < 9; ++i) Hn.h[i / 3][i % 3] = h[i];
+    hom3 Hd = hom3_multiply(Tq_inv, hom3_multiply(Hn, Tp));
+    float w = Hd.h[2][2];
+    if(!(fabsf(w) > 1e-8f)) return 0;
+    for(int i = 0; i < 9; ++i) H->h[i / 3][i % 3] = Hd.h[i / 3][i % 3] / w;
+    return 1;
 }
 
-
-// Project an image onto a cylinder then flatten it, given focal lengths in pixels
+// Project an image onto a cylinder then flatten it, given focal lengths in pixels.
+// The mapping is cached per size and focal length, so projecting frames of a video only samples.
 image cylindrical_project(image m, float f)
 {
-    int xc = m.w / 2, yc = m.h / 2;
-    int w = 2*f*atan2f(xc, f);
-    image out = make_image(w, m.h, m.c);
-    for(int k = 0; k < out.c; ++k) {
-        #pragma omp parallel for
-        for(int y = 0; y < out.h; ++y) {
-            for(int x = 0; x < out.w; ++x) {
-                float theta = (x - w/2) / f;
-                float X = f*sinf(theta), Y = y-yc, Z = f*cosf(theta); // cylinder coordinates
-                float mx = f*X/Z + xc, my = f*Y/Z + yc; // unrolled coordinates
-                float val = bilinear_interpolate(m, mx, my, k);
-                set_pixel(&out, x, y, k, val);
-            }
-        }
-    }
+    const remap_map* map = cylindrical_remap_map(m.w, m.h, f);
+    image out = remap(m, map);
+    release_remap_map(map);
     return out;
 }
 
-static inline matrix RANSAC(match* m, int n, float thresh, int k, int cutoff)
-{
-    int best = -1;
-    matrix Hb = make_translation_homography(256, 0), H = make_matrix(3, 3);
-    for(int i = 0; i < k; ++i) {
-        shuffle_matches(m, n);
-        H = compute_homography(m, 4);
-        if(!H.data) continue;
-        int num_inliers = model_inliers(H, m, n, thresh);
-        if(num_inliers > best) {
-            best = num_inliers;
-            H = compute_homography(m, num_inliers);
-            if(H.data) Hb = H;
-            if(best > cutoff) break;
+// Solves the homography through 4 matches exactly, by gaussian elimination of the 8x8 system
+// of compute_homography in double. Returns 0 if the system is singular.
+static int homography_from_sample(const match* m, const int* idx, hom3* H)
+{
+    double A[8][9];
+    for(int i = 0; i < 4; ++i) {
+        double x = m[idx[i]].p.x, y = m[idx[i]].p.y, u = m[idx[i]].q.x, v = m[idx[i]].q.y;
+        double r0[9] = { x, y, 1, 0, 0, 0, -x*u, -y*u, u };
+        double r1[9] = { 0, 0, 0, x, y, 1, -x*v, -y*v, v };
+        memcpy(A[2*i], r0, sizeof(r0));
+        memcpy(A[2*i+1], r1, sizeof(r1));
+    }
+    for(int k = 0; k < 8; ++k) {
+        int pivot = k;
+        for(int i = k + 1; i < 8; ++i) if(fabs(A[i][k]) > fabs(A[pivot][k])) pivot = i;
+        if(fabs(A[pivot][k]) < 1e-9) return 0;
+        for(int j = k; j < 9; ++j) {
+            double tmp = A[k][j]; A[k][j] = A[pivot][j]; A[pivot][j] = tmp;
         }
+        for(int i = k + 1; i < 8; ++i) {
+            double s = A[i][k] / A[k][k];
+            for(int j = k; j < 9; ++j) A[i][j] -= s*A[k][j];
+        }
+    }
+    double h[8];
+    for(int k = 7; k >= 0; --k) {
+        double v = A[k][8];
+        for(int j = k + 1; j < 8; ++j) v -= A[k][j]*h[j];
+        h[k] = v / A[k][k];
+    }
+    for(int i = 0; i < 8; ++i) H->h[i / 3][i % 3] = h[i];
+    H->h[2][2] = 1;
+    return 1;
+}
+
+static inline float cross3(point a, point b, point c)
+{
+    return (b.x - a.x)*(c.y - a.y) - (b.y - a.y)*(c.x - a.x);
+}
+
+// A sample is degenerate if three of its points are nearly collinear in either image,
+// or if its triangles do not all keep or all flip their orientation, which no homography
+// that keeps the points in front of the camera can do.
+static int degenerate_sample(const match* m, const int* idx)
+{
+    static const int tri[4][3] = { {0, 1, 2}, {0, 1, 3}, {0, 2, 3}, {1, 2, 3} };
+    int flips = 0;
+    for(int t = 0; t < 4; ++t) {
+        const match *a = m + idx[tri[t][0]], *b = m + idx[tri[t][1]], *c = m + idx[tri[t][2]];
+        float cp = cross3(a->p, b->p, c->p), cq = cross3(a->q, b->q, c->q);
+        if(fabsf(cp) < RANSAC_MIN_AREA || fabsf(cq) < RANSAC_MIN_AREA) return 1;
+        flips += (cp > 0) != (cq > 0);
     }
-    printf("found %d inliers\n", best);
-    free_matrix(&H);
-    return Hb;
+    return flips != 0 && flips != 4;
 }
 
-int model_inliers(matrix H, match* m, int n, float thresh)
+// Counts the matches that H projects within thresh, without branches so that the loop vectorizes.
+// The coordinates are split in arrays: px, py in image a and qx, qy in image b.
+static int count_inliers(hom3 H, const float* px, const float* py, const float* qx, const float* qy, int n, float thresh)
 {
+    const float h00 = H.h[0][0], h01 = H.h[0][1], h02 = H.h[0][2];
+    const float h10 = H.h[1][0], h11 = H.h[1][1], h12 = H.h[1][2];
+    const float h20 = H.h[2][0], h21 = H.h[2][1], h22 = H.h[2][2];
+    const float t2 = thresh*thresh;
     int count = 0;
+    #pragma omp simd reduction(+:count)
     for(int i = 0; i < n; ++i) {
-        point proj = project_point(H, m[count].p), q = m[count].q;
-        float dist = point_distance(proj, q);
-        if(dist < thresh) count++;
-        else {
-            match tmp = m[count];
-            for(int j = count; j < n-1; ++j) m[j] = m[j+1];
-            m[n-1] = tmp;
+        float w = h20*px[i] + h21*py[i] + h22;
+        float dx = (h00*px[i] + h01*py[i] + h02) / w - qx[i];
+        float dy = (h10*px[i] + h11*py[i] + h12) / w - qy[i];
+        count += dx*dx + dy*dy < t2;
+    }
+    return count;
+}
+
+// random stream of hypothesis t, the same whichever thread scores it
+static inline unsigned int hypothesis_state(unsigned int seed, int t)
+{
+    unsigned int s = seed ^ (0x9e3779b9u*(unsigned int)(t + 1));
+    s ^= s >> 16; s *= 0x7feb352du;
+    s ^= s >> 15; s *= 0x846ca68bu;
+    s ^= s >> 16;
+    return s ? s : 0x9e3779b9u;
+}
+
+// draws 4 distinct indexes below size. With newest, the sample is size - 1 and 3 indexes below it
+static inline void draw_sample(unsigned int* state, int size, int newest, int* idx)
+{
+    int first = 0;
+    if(newest) idx[first++] = --size;
+    for(int i = first; i < 4; ++i) {
+        int j, dup;
+        do {
+            j = xorshift32(state) % size;
+            dup = 0;
+            for(int k = 0; k < i; ++k) dup |= idx[k] == j;
+        } while(dup);
+        idx[i] = j;
+    }
+}
+
+// PROSAC growth of the sampled top matches, from Chum and Matas: hypothesis t samples from
+// the best size matches, size growing from 4 to n so that the expected number of samples
+// per subset matches uniform sampling over iters hypotheses. Until its share of hypotheses is
+// drawn, every sample of a size holds its newest match size - 1, the rest come from the matches before.
+typedef struct {
+    int n, size;
+    double tn, tprime;
+} prosac_state;
+
+static prosac_state make_prosac_state(int n, int iters)
+{
+    prosac_state s = { n, 4, iters, 1 };
+    for(int i = 0; i < 4; ++i) s.tn *= (double)(4 - i) / (n - i);
+    return s;
+}
+
+// int* newest: set to 1 if the sample must hold match size - 1, 0 to draw all 4 below size
+static int prosac_size(prosac_state* s, int t, int* newest)
+{
+    while(s->size < s->n && t + 1 > s->tprime) {
+        double next = s->tn*(s->size + 1) / (s->size + 1 - 4);
+        s->tprime += ceil(next - s->tn);
+        s->tn = next;
+        s->size++;
+    }
+    *newest = t + 1 <= s->tprime;
+    return s->size;
+}
+
+// hypotheses needed to draw an all inlier sample with the given confidence
+static int adaptive_iterations(int inliers, int n, float confidence, int iters)
+{
+    double w = (double)inliers / n, w4 = w*w*w*w;
+    if(w4 >= 1) return 0;
+    if(w4 <= 0) return iters;
+    double k = log(1 - confidence) / log(1 - w4);
+    return k < iters ? (int)ceil(k) : iters;
+}
+
+static inline int match_distance_compare(const void* a, const void* b)
+{
+    const match *ma = a, *mb = b;
+    if(ma->dist != mb->dist) return ma->dist < mb->dist ? -1 : 1;
+    if(ma->ai != mb->ai) return ma->ai < mb->ai ? -1 : 1;
+    return (ma->bi > mb->bi) - (ma->bi < mb->bi);
+}
+
+ransac_options default_ransac_options()
+{
+    ransac_options r = {0};
+    r.thresh = 2.f;
+    r.iters = 10000;
+    r.confidence = .995f;
+    r.prosac = 1;
+    return r;
+}
+
+int ransac_homography(match* m, int n, ransac_options r, hom3* H)
+{
+    if(n < 4) return 0;
+    if(r.prosac) qsort(m, n, sizeof(match), match_distance_compare);
+
+    float* px = malloc(4*n*sizeof(float));
+    float *py = px + n, *qx = py + n, *qy = qx + n;
+    for(int i = 0; i < n; ++i) px[i] = m[i].p.x, py[i] = m[i].p.y, qx[i] = m[i].q.x, qy[i] = m[i].q.y;
+
+    prosac_state ps = make_prosac_state(n, r.iters);
+    int sizes[RANSAC_ROUND], newest[RANSAC_ROUND] = {0}, counts[RANSAC_ROUND];
+    hom3 models[RANSAC_ROUND];
+    int best = 0, needed = r.iters;
+    hom3 Hb = hom3_identity();
+    for(int t0 = 0; t0 < needed; t0 += RANSAC_ROUND) {
+        int round = MIN(RANSAC_ROUND, needed - t0);
+        for(int i = 0; i < round; ++i) sizes[i] = r.prosac ? prosac_size(&ps, t0 + i, &newest[i]) : n;
+
+        #pragma omp parallel for schedule(dynamic, 4)
+        for(int i = 0; i < round; ++i) {
+            unsigned int state = hypothesis_state(r.seed, t0 + i);
+            int idx[4];
+            draw_sample(&state, sizes[i], newest[i], idx);
+            counts[i] = 0;
+            if(degenerate_sample(m, idx) || !homography_from_sample(m, idx, &models[i])) continue;
+            counts[i] = count_inliers(models[i], px, py, qx, qy, n, r.thresh);
+        }
+        // the earliest hypothesis wins ties, so the result does not depend on the schedule
+        for(int i = 0; i < round; ++i) {
+            if(counts[i] > best) best = counts[i], Hb = models[i];
+        }
+        if(best >= 4) needed = MIN(needed, MAX(t0 + round, adaptive_iterations(best, n, r.confidence, r.iters)));
+        if(r.cutoff > 0 && best > r.cutoff) break;
+    }
+    free(px);
+    if(best < 4) return 0;
+
+    // refit on all inliers while that gains inliers
+    best = model_inliers(Hb, m, n, r.thresh);
+    for(int i = 0; i < 3; ++i) {
+        hom3 Hr;
+        if(!compute_homography(m, best, &Hr)) break;
+        int inliers = model_inliers(Hr, m, n, r.thresh);
+        if(inliers < best) {
+            model_inliers(Hb, m, n, r.thresh);
+            break;
+        }
+        Hb = Hr;
+        if(inliers == best) break;
+        best = inliers;
+    }
+    *H = Hb;
+    return best;
+}
+
+// Projects the matches in batches, then moves the inliers to the front and the outliers
+// behind them, both in their original order.
+int model_inliers(hom3 H, match* m, int n, float thresh)
+{
+    match* outliers = malloc((n ? n : 1)*sizeof(match));
+    point proj[PROJECT_BATCH];
+    int count = 0, rejected = 0;
+    for(int b = 0; b < n; b += PROJECT_BATCH) {
+        int batch = MIN(PROJECT_BATCH, n - b);
+        for(int i = 0; i < batch; ++i) proj[i] = m[b + i].p;
+        project_points(H, proj, proj, batch);
+        for(int i = 0; i < batch; ++i) {
+            if(point_distance(proj[i], m[b + i].q) < thresh) m[count++] = m[b + i];
+            else outliers[rejected++] = m[b + i];
         }
     }
+    memcpy(m + count, outliers, rejected*sizeof(match));
+    free(outliers);
     return count;
 }
 
@@ -218,6 +409,22 @@ static inline int match_compare(const void* a, const void* b)
     else return 0;
 }
 
+// sort matches by distance and keep only the best match of every point in b.
+// returns: the number of matches left at the start of m.
+static int unique_matches(match* m, int an, int bn)
+{
+    int* seen = calloc(bn, sizeof(int)), count = 0;
+    qsort(m, an, sizeof(match), &match_compare);
+    for(int i = 0; i < an; ++i) {
+        if(!seen[m[i].bi]) {
+            seen[m[i].bi] = 1;
+            m[count++] = m[i];
+        }
+    }
+    free(seen);
+    return count;
+}
+
 match* match_descriptors(descriptor* a, int an, descriptor* b, int bn, int* mn)
 {
     *mn = an; // at most an matches.
@@ -238,29 +445,74 @@ match* match_descriptors(descriptor* a, int an, descriptor* b, int bn, int* mn)
         m[j].p = a[j].p, m[j].q = b[bi].p;
     }
 
-    int* seen = calloc(bn, sizeof(int)), count = 0;
-    // sort matches by distance and assert that they are one-to-one
-    qsort(m, an, sizeof(match), &match_compare);
-    for(int i = 0; i < an; ++i) {
-        if(!seen[m[i].bi]) {
-            seen[m[i].bi] = 1;
-            m[count++] = m[i];
-        }
+    *mn = unique_matches(m, an, bn);
+    return m;
+}
+
+// Turns the nearest neighbours of a into matches, dropping those that fail the ratio test.
+static match* matches_from_nearest(descriptor_set a, const point* bp, int bn, const nearest_pair* nn, float ratio, int* mn)
+{
+    match* m = calloc(a.n ? a.n : 1, sizeof(match));
+    int n = 0;
+    for(int j = 0; j < a.n; ++j) {
+        if(!ratio_test(nn[j], ratio)) continue;
+        int bi = nn[j].best;
+        m[n].dist = nn[j].best_dist;
+        m[n].ai = j, m[n].bi = bi;
+        m[n].p = a.p[j], m[n].q = bp[bi];
+        n++;
     }
-    *mn = count;
-    free(seen);
+    *mn = unique_matches(m, n, bn);
+    return m;
+}
+
+match* match_descriptor_sets(descriptor_set a, descriptor_set b, distance_metric metric, float ratio, int* mn)
+{
+    *mn = 0;
+    if(a.n == 0 || b.n == 0) return calloc(1, sizeof(match));
+    nearest_pair* nn = calloc(a.n, sizeof(nearest_pair));
+    nearest_descriptors(a, b, metric, nn);
+    match* m = matches_from_nearest(a, b.p, b.n, nn, ratio, mn);
+    free(nn);
+    return m;
+}
+
+match* match_descriptor_index(descriptor_set a, kd_forest f, float ratio, int* mn)
+{
+    *mn = 0;
+    if(a.n == 0 || f.points.n == 0) return calloc(1, sizeof(match));
+    nearest_pair* nn = calloc(a.n, sizeof(nearest_pair));
+    kd_forest_nearest(f, a, nn);
+    match* m = matches_from_nearest(a, f.points.p, f.points.n, nn, ratio, mn);
+    free(nn);
+    return m;
+}
+
+// Brute force matching for small sets, approximate search in a k-d forest for large ones.
+static match* match_panorama_descriptors(descriptor_set a, descriptor_set b, int* mn)
+{
+    // binary descriptors are cheap enough to always compare all pairs
+    if(b.n < INDEX_MATCH_SIZE || b.type == BINARY_DESCRIPTOR) return match_descriptor_sets(a, b, DISTANCE_L1, 1.f, mn);
+    kd_forest f = make_kd_forest(b.d, INDEX_MATCH_TREES, INDEX_MATCH_CHECKS, DISTANCE_L1);
+    kd_forest_add(&f, b);
+    match* m = match_descriptor_index(a, f, 1.f, mn);
+    free_kd_forest(&f);
     return m;
 }
 
-image combine_images(image a, image b, matrix H)
+image combine_images(image a, image b, hom3 H, blend_mode blend, int bands)
 {
-    matrix Hinv = invert_matrix(H);
+    hom3 Hinv;
+    if(!hom3_invert(H, &Hinv)) {
+        fprintf(stderr, "matrix is not invertible\n");
+        return make_empty_image(0, 0, a.c);
+    }
 
     // Project the corners of image b into image a coordinates.
-    point c1 = project_point(Hinv, make_point(0, 0));
-    point c2 = project_point(Hinv, make_point(b.w-1, 0));
-    point c3 = project_point(Hinv, make_point(0, b.h-1));
-    point c4 = project_point(Hinv, make_point(b.w-1, b.h-1));
+    point c1 = hom3_project(Hinv, make_point(0, 0));
+    point c2 = hom3_project(Hinv, make_point(b.w-1, 0));
+    point c3 = hom3_project(Hinv, make_point(0, b.h-1));
+    point c4 = hom3_project(Hinv, make_point(b.w-1, b.h-1));
 
     // Find top left and bottom right corners of image b warped into image a.
     point topleft  = { min4f(c1.x, c2.x, c3.x, c4.x), min4f(c1.y, c2.y, c3.y, c4.y) };
@@ -271,57 +523,590 @@ image combine_images(image a, image b, matrix H)
     int w = MAX(a.w, botright.x) - dx, h = MAX(a.h, botright.y) - dy;
 
     image out = make_image(w, h, a.c);
+    rect roi = { (int)topleft.x - dx, (int)topleft.y - dy, 0, 0 };
+    roi.w = (int)ceilf(botright.x) - dx - roi.x, roi.h = (int)ceilf(botright.y) - dy - roi.y;
+    if(blend != BLEND_NONE) {
+        image weight = make_image(w, h, 1);
+        rect aroi = { -dx, -dy, a.w, a.h };
+        blend_warp(a, hom3_translation(dx, dy), out, weight, aroi, blend, bands);
+        blend_warp(b, hom3_multiply(H, hom3_translation(dx, dy)), out, weight, roi, blend, bands);
+        free_image(&weight);
+        return out;
+    }
     // Paste image a into the new image offset by dx and dy.
-    for(int k = 0; k < a.c; ++k) {
-        #pragma omp parallel for
-        for(int y = 0; y < a.h; ++y) {
-            for(int x = 0; x < a.w; ++x) {
-                set_pixel(&out, x-dx, y-dy, k, get_pixel(a, x, y, k));
-            }
+    #pragma omp parallel for
+    for(int i = 0; i < a.c*a.h; ++i) {
+        int k = i / a.h, y = i % a.h;
+        memcpy(out.data + (size_t)k*w*h + (size_t)(y-dy)*w - dx, a.data + (size_t)i*a.w, a.w*sizeof(float));
+    }
+    // Paste in image b by projecting the canvas back to b, shifted by the offsets
+    warp_perspective(b, hom3_multiply(H, hom3_translation(dx, dy)), out, roi);
+    return out;
+}
+
+panorama_options default_panorama_options()
+{
+    panorama_options o = {0};
+    o.detector = HARRIS_DETECTOR;
+    o.descriptor = FLOAT_DESCRIPTOR;
+    o.sigma = 2.f, o.thresh = 2.f, o.nms = 3;
+    o.fast_thresh = .08f, o.fast_arc = 9;
+    o.levels = 1, o.level_scale = 2.f;
+    o.inlier_thresh = 2.f;
+    o.iters = 10000, o.cutoff = 0;
+    o.confidence = .995f, o.prosac = 1;
+    o.neighbors = 1, o.min_inliers = 12;
+    o.coarse = 0, o.search_radius = 16.f;
+    o.blend = BLEND_NONE, o.bands = 5;
+    return o;
+}
+
+// corners of one image with their descriptors, keeping at most budget corners if budget > 0
+static descriptor_set detect_level(image m, panorama_options o, int budget)
+{
+    int n;
+    float* score;
+    point* p;
+    if(o.detector == FAST_DETECTOR) p = fast_corners(m, o.fast_thresh, o.fast_arc, 1, o.subpixel, &score, &n);
+    else {
+        corner_response_type type = o.detector == SHI_TOMASI_DETECTOR ? SHI_TOMASI_RESPONSE : HARRIS_RESPONSE;
+        p = harris_corners(m, o.sigma, type, o.thresh, o.nms, o.subpixel, &score, &n);
+    }
+
+    n = grid_bucket_keypoints(p, score, n, m.w, m.h, o.cell, o.per_cell);
+    if(o.anms) n = anms_keypoints(p, score, n, budget, .9f);
+    else n = retain_best_keypoints(p, score, n, budget);
+    descriptor_set s = o.descriptor == BINARY_DESCRIPTOR ? describe_orb(m, p, score, n) : describe_patches(m, p, score, n);
+    free(p); free(score);
+    return s;
+}
+
+// Detects and describes corners on every pyramid level from first_level on, one level per thread.
+// The budget and the grid cells are split over the levels by area.
+static descriptor_set detect_keypoints(image m, panorama_options o)
+{
+    if(o.levels <= 1) return detect_level(m, o, o.max_keypoints);
+
+    image_pyramid py = make_image_pyramid(m, o.levels, o.level_scale);
+    int first = clamp(o.first_level, 0, py.levels - 1);
+    float area = 0;
+    for(int l = first; l < py.levels; ++l) area += (float)py.level[l].w*py.level[l].h;
+
+    descriptor_set* sets = calloc(py.levels, sizeof(descriptor_set));
+    #pragma omp parallel for schedule(dynamic)
+    for(int l = first; l < py.levels; ++l) {
+        image level = py.level[l];
+        float fraction = level.w*level.h / area;
+        int budget = o.max_keypoints > 0 ? MAX(1, (int)(o.max_keypoints*fraction + .5f)) : 0;
+        panorama_options lo = o;
+        if(o.cell > 0) lo.cell = MAX(1, o.cell*level.w / m.w);
+        sets[l] = detect_level(level, lo, budget);
+        for(int i = 0; i < sets[l].n; ++i) {
+            sets[l].p[i] = pyramid_to_base(py, l, sets[l].p[i]);
+            sets[l].level[i] = l;
         }
     }
-    // Paste in image b by projecting back to b and interpolate if within bounds
-    #pragma omp parallel for
-    for(int k = 0; k < a.c; ++k) {
-        for(int y = topleft.y; y < botright.y; ++y) {
-            for(int x = topleft.x; x < botright.x; ++x) {
-                point p = project_point(H, make_point(x, y));
-                if(p.x >= 0 && p.x < b.w && p.y >= 0 && p.y < b.h) {
-                    float v = bilinear_interpolate(b, p.x, p.y, k);
-                    set_pixel(&out, x-dx, y-dy, k, v);
+    descriptor_set s = concat_descriptor_sets(sets + first, py.levels - first);
+    for(int l = first; l < py.levels; ++l) free_descriptor_set(&sets[l]);
+    free(sets);
+    free_image_pyramid(&py);
+    return s;
+}
+
+static ransac_options panorama_ransac_options(panorama_options o)
+{
+    ransac_options r = { o.inlier_thresh, o.iters, o.cutoff, o.confidence, o.prosac, o.seed };
+    return r;
+}
+
+// Detects and describes corners on m downscaled by o.coarse, with the keypoints in full resolution
+// coordinates. scale: full resolution pixels per downscaled pixel.
+static descriptor_set detect_coarse(image m, panorama_options o, float* scale)
+{
+    // box_downscale drops the leftover columns and rows, so the factor is the exact scale on both axes
+    const int factor = clamp(o.coarse, 1, MIN(m.w, m.h));
+    image small = box_downscale(m, factor);
+    *scale = factor;
+    if(o.cell > 0) o.cell = MAX(1, o.cell / factor);
+    descriptor_set s = detect_level(small, o, o.max_keypoints);
+    for(int i = 0; i < s.n; ++i) {
+        s.p[i].x = (s.p[i].x + .5f)*(*scale) - .5f;
+        s.p[i].y = (s.p[i].y + .5f)*(*scale) - .5f;
+        s.level[i] = 1;
+    }
+    free_image(&small);
+    return s;
+}
+
+// The bounding box of the points projected by H, grown by margin and clipped to m.
+// All of m if a point maps behind the camera.
+static rect projected_bounds(image m, hom3 H, const point* p, int n, float margin)
+{
+    point lo = {0, 0}, hi = {0, 0};
+    for(int i = 0; i < n; ++i) {
+        if(H.h[2][0]*p[i].x + H.h[2][1]*p[i].y + H.h[2][2] <= 0) return image_rect(m);
+        point q = hom3_project(H, p[i]);
+        if(i == 0) lo = hi = q;
+        lo.x = fminf(lo.x, q.x), lo.y = fminf(lo.y, q.y);
+        hi.x = fmaxf(hi.x, q.x), hi.y = fmaxf(hi.y, q.y);
+    }
+    // clamp before converting, homographies close to degenerate put points far away
+    lo.x = fmaxf(lo.x - margin, 0), lo.y = fmaxf(lo.y - margin, 0);
+    hi.x = fminf(hi.x + margin, m.w), hi.y = fminf(hi.y + margin, m.h);
+    rect r = { (int)lo.x, (int)lo.y, (int)ceilf(hi.x) - (int)lo.x, (int)ceilf(hi.y) - (int)lo.y };
+    return intersect_rect(r, image_rect(m));
+}
+
+// Full resolution corners of the windows wa of a and wb of b, n of each, one window per thread.
+static void detect_windows(image a, image b, const rect* wa, const rect* wb, int n, panorama_options o,
+                           descriptor_set* da, descriptor_set* db)
+{
+    descriptor_set* sets = calloc(2*n, sizeof(descriptor_set));
+    int budget = o.max_keypoints > 0 ? MAX(1, o.max_keypoints / n) : 0;
+    #pragma omp parallel for schedule(dynamic)
+    for(int i = 0; i < 2*n; ++i) {
+        image m = i < n ? a : b;
+        rect r = i < n ? wa[i] : wb[i - n];
+        if(r.w < 8 || r.h < 8) {
+            point none = {0, 0};
+            float no_score = 0;
+            sets[i] = o.descriptor == BINARY_DESCRIPTOR ? describe_orb(m, &none, &no_score, 0) : describe_patches(m, &none, &no_score, 0);
+            continue;
+        }
+        image crop = crop_image(m, r.x, r.y, r.w, r.h);
+        sets[i] = detect_level(crop, o, budget);
+        for(int k = 0; k < sets[i].n; ++k) sets[i].p[k].x += r.x, sets[i].p[k].y += r.y;
+        free_image(&crop);
+    }
+    *da = concat_descriptor_sets(sets, n);
+    *db = concat_descriptor_sets(sets + n, n);
+    for(int i = 0; i < 2*n; ++i) free_descriptor_set(&sets[i]);
+    free(sets);
+}
+
+// Guided matching: the nearest descriptors of b to every descriptor of a among the keypoints
+// of b within radius of the keypoint of a projected by H. The keypoints of b are bucketed in
+// a grid of radius sized cells, so every query only compares the 3x3 cells around it.
+static match* guided_matches(descriptor_set a, descriptor_set b, hom3 H, float radius, int* mn)
+{
+    *mn = 0;
+    if(a.n == 0 || b.n == 0) return calloc(1, sizeof(match));
+    float maxx = 0, maxy = 0;
+    for(int i = 0; i < b.n; ++i) maxx = fmaxf(maxx, b.p[i].x), maxy = fmaxf(maxy, b.p[i].y);
+    const int cols = (int)(maxx / radius) + 1, rows = (int)(maxy / radius) + 1;
+    int* start = calloc((size_t)cols*rows + 1, sizeof(int));
+    int* cell = malloc(b.n*sizeof(int));
+    int* order = malloc(b.n*sizeof(int));
+    for(int i = 0; i < b.n; ++i) {
+        int cx = clamp((int)(b.p[i].x / radius), 0, cols - 1), cy = clamp((int)(b.p[i].y / radius), 0, rows - 1);
+        cell[i] = cy*cols + cx;
+        start[cell[i] + 1]++;
+    }
+    for(int c = 0; c < cols*rows; ++c) start[c + 1] += start[c];
+    int* fill = malloc((size_t)cols*rows*sizeof(int));
+    memcpy(fill, start, (size_t)cols*rows*sizeof(int));
+    for(int i = 0; i < b.n; ++i) order[fill[cell[i]]++] = i;
+    free(fill); free(cell);
+
+    point* proj = malloc(a.n*sizeof(point));
+    project_points(H, a.p, proj, a.n);
+    nearest_pair* nn = malloc(a.n*sizeof(nearest_pair));
+    #pragma omp parallel for schedule(dynamic, 64)
+    for(int j = 0; j < a.n; ++j) {
+        nearest_pair best = { -1, -1, FLT_MAX, FLT_MAX };
+        point q = proj[j];
+        int cx = (int)floorf(q.x / radius), cy = (int)floorf(q.y / radius);
+        // the point may project anywhere, even to infinity
+        if(!(q.x > -radius && q.y > -radius && q.x < (cols + 1)*radius && q.y < (rows + 1)*radius)) cx = cy = -2;
+        for(int y = MAX(cy - 1, 0); y <= MIN(cy + 1, rows - 1) && cy > -2; ++y) {
+            for(int x = MAX(cx - 1, 0); x <= MIN(cx + 1, cols - 1); ++x) {
+                for(int k = start[y*cols + x]; k < start[y*cols + x + 1]; ++k) {
+                    int i = order[k];
+                    if(point_distance(q, b.p[i]) > radius) continue;
+                    float d = a.type == BINARY_DESCRIPTOR
+                            ? hamming_distance(descriptor_bits(a, j), descriptor_bits(b, i), a.stride)
+                            : descriptor_distance(descriptor_row(a, j), descriptor_row(b, i), a.stride, DISTANCE_L1);
+                    if(d < best.best_dist || (d == best.best_dist && i < best.best)) {
+                        best.second = best.best, best.second_dist = best.best_dist;
+                        best.best = i, best.best_dist = d;
+                    }
+                    else if(d < best.second_dist) best.second = i, best.second_dist = d;
                 }
             }
         }
+        nn[j] = best;
     }
+    match* m = matches_from_nearest(a, b.p, b.n, nn, 1.f, mn);
+    free(start); free(order); free(proj); free(nn);
+    return m;
+}
 
-    return out;
+// Huber cost of the reprojection errors of the normalized matches p -> q under the homography g,
+// with g[8] = 1. If JtJ is not NULL, also accumulates the weighted normal equations JtJ (lower
+// triangle) and Jtr of the Gauss-Newton step.
+static double reprojection_cost(const float* g, const point* p, const point* q, int n, float d,
+                                double JtJ[8][8], double* Jtr)
+{
+    double cost = 0;
+    for(int i = 0; i < n; ++i) {
+        float x = p[i].x, y = p[i].y;
+        float w = g[6]*x + g[7]*y + 1;
+        if(!(fabsf(w) > 1e-8f)) return DBL_MAX;
+        float iw = 1 / w;
+        float u = (g[0]*x + g[1]*y + g[2])*iw, v = (g[3]*x + g[4]*y + g[5])*iw;
+        float ru = u - q[i].x, rv = v - q[i].y, e = sqrtf(ru*ru + rv*rv);
+        cost += e <= d ? .5*e*e : d*(e - .5*d);
+        if(!JtJ) continue;
+        float wt = e <= d ? 1 : d / e;
+        float ju[8] = { x*iw, y*iw, iw, 0, 0, 0, -u*x*iw, -u*y*iw };
+        float jv[8] = { 0, 0, 0, x*iw, y*iw, iw, -v*x*iw, -v*y*iw };
+        for(int r = 0; r < 8; ++r) {
+            Jtr[r] += wt*(ju[r]*ru + jv[r]*rv);
+            for(int c = 0; c <= r; ++c) JtJ[r][c] += wt*(ju[r]*ju[c] + jv[r]*jv[c]);
+        }
+    }
+    return cost;
 }
 
-image panorama_image(image a, image b, float sigma, float thresh, int nms, float inlier_thresh, int iters, int cutoff, int draw_matches)
+// Levenberg-Marquardt refinement of H on the reprojection error of the matches, in normalized coordinates,
+// with huber weights so that matches off by more than delta pixels pull less than the precise ones.
+// The algebraic error fitted by compute_homography weighs every match alike, so a few matches that
+// are within the RANSAC threshold but not exact can bias it. Only steps that lower the cost are taken,
+// so H is only replaced by a homography with a lower cost than its own.
+static void refine_homography(const match* m, int n, float delta, hom3* H)
 {
-    int num_a=0, num_b=0, num_matches=0;
-    descriptor* ad = harris_corner_detector(a, sigma, thresh, nms, &num_a);
-    descriptor* bd = harris_corner_detector(b, sigma, thresh, nms, &num_b);
-    match* m = match_descriptors(ad, num_a, bd, num_b, &num_matches);
+    hom3 Tp, Tq, Tp_inv, Tq_inv;
+    if(n < 8 || !normalizing_transform(m, n, 0, &Tp) || !normalizing_transform(m, n, 1, &Tq)) return;
+    if(!hom3_invert(Tp, &Tp_inv) || !hom3_invert(Tq, &Tq_inv)) return;
+    hom3 G = hom3_multiply(Tq, hom3_multiply(*H, Tp_inv));
+    if(!(fabsf(G.h[2][2]) > 1e-8f)) return;
+    float g[8];
+    for(int i = 0; i < 8; ++i) g[i] = G.h[i / 3][i % 3] / G.h[2][2];
+    const float d = delta*Tq.h[0][0]; // delta in normalized units
+    point* p = malloc(2*n*sizeof(point));
+    point* q = p + n;
+    for(int i = 0; i < n; ++i) p[i] = hom3_project(Tp, m[i].p), q[i] = hom3_project(Tq, m[i].q);
+
+    matrix A = make_matrix(8, 8), B = make_matrix(8, 1);
+    const double start = reprojection_cost(g, p, q, n, d, NULL, NULL);
+    double best = start, lambda = 1e-3;
+    for(int it = 0; it < REFINE_ITERS && best < DBL_MAX; ++it) {
+        double JtJ[8][8] = {{0}}, Jtr[8] = {0};
+        reprojection_cost(g, p, q, n, d, JtJ, Jtr);
+        for(int r = 0; r < 8; ++r) {
+            for(int c = 0; c <= r; ++c) A.data[r][c] = JtJ[r][c];
+            A.data[r][r] += lambda*JtJ[r][r];
+            B.data[r][0] = -Jtr[r];
+        }
+        if(!cholesky_solve(A, B)) break;
+        float step[8];
+        for(int r = 0; r < 8; ++r) step[r] = g[r] + B.data[r][0];
+        double cost = reprojection_cost(step, p, q, n, d, NULL, NULL);
+        if(cost < best) {
+            memcpy(g, step, sizeof(g));
+            best = cost;
+            lambda = MAX(lambda / 10, 1e-7);
+        }
+        else lambda *= 10;
+    }
+    free_matrix(&A); free_matrix(&B);
+    free(p);
+    if(!(best < start)) return;
+    hom3 Gn = {{{g[0], g[1], g[2]}, {g[3], g[4], g[5]}, {g[6], g[7], 1}}};
+    hom3 Hr = hom3_multiply(Tq_inv, hom3_multiply(Gn, Tp));
+    if(!(fabsf(Hr.h[2][2]) > 1e-8f)) return;
+    for(int i = 0; i < 9; ++i) H->h[i / 3][i % 3] = Hr.h[i / 3][i % 3] / Hr.h[2][2];
+}
 
-    matrix H = RANSAC(m, num_matches, inlier_thresh, iters, cutoff);
+// Coarse-to-fine registration of a to b. A first homography comes from the coarse descriptors ca and cb,
+// detected at scale by detect_coarse. Full resolution corners are then detected in a grid of windows
+// spread over the overlap it predicts in a, and in the windows of b it predicts them to land in,
+// matched only within search_radius of where it projects them, and fit again.
+// Keeps the coarse homography if the guided matches do not give a well supported one.
+static int register_coarse_to_fine(image a, image b, descriptor_set ca, descriptor_set cb, float scale,
+                                   panorama_options o, hom3* H)
+{
+    int n;
+    match* m = match_panorama_descriptors(ca, cb, &n);
+    ransac_options r = panorama_ransac_options(o);
+    r.thresh *= scale;
+    hom3 H0 = hom3_identity(), Hinv;
+    int coarse = ransac_homography(m, n, r, &H0);
+    free(m);
+    if(coarse < 4 || !hom3_invert(H0, &Hinv)) return 0;
 
-    if(draw_matches) {
-        draw_corners(&a, ad, num_a);
-        draw_corners(&b, bd, num_b);
-        image matches_image = draw_inliers(a, b, H, m, num_matches, inlier_thresh);
-        save_image_png(matches_image, "matches");
+    point corner[4] = { {0, 0}, {b.w, 0}, {0, b.h}, {b.w, b.h} };
+    rect overlap = projected_bounds(a, Hinv, corner, 4, 0);
+    if(overlap.w <= 0 || overlap.h <= 0) return 0;
+    const int cols = clamp(overlap.w / FINE_WINDOW, 1, FINE_GRID), rows = clamp(overlap.h / FINE_WINDOW, 1, FINE_GRID);
+    rect* wa = malloc(2*cols*rows*sizeof(rect));
+    rect* wb = wa + cols*rows;
+    for(int i = 0; i < cols*rows; ++i) {
+        int x = i % cols, y = i / cols;
+        rect w = { 0, 0, MIN(FINE_WINDOW, overlap.w), MIN(FINE_WINDOW, overlap.h) };
+        w.x = overlap.x + (int)((overlap.w - w.w)*(x + .5f) / cols);
+        w.y = overlap.y + (int)((overlap.h - w.h)*(y + .5f) / rows);
+        wa[i] = w;
+        point pw[4] = { {w.x, w.y}, {w.x + w.w, w.y}, {w.x, w.y + w.h}, {w.x + w.w, w.y + w.h} };
+        wb[i] = projected_bounds(b, H0, pw, 4, o.search_radius);
     }
-    free_descriptors(ad, num_a); free_descriptors(bd, num_b); free(m);
+    descriptor_set fa, fb;
+    detect_windows(a, b, wa, wb, cols*rows, o, &fa, &fb);
+    free(wa);
 
-    image panorama = combine_images(a, b, H);
-    return panorama;
+    m = guided_matches(fa, fb, H0, o.search_radius, &n);
+    hom3 Hf;
+    int fine = ransac_homography(m, n, panorama_ransac_options(o), &Hf);
+    if(fine >= MAX(4, o.min_inliers)) refine_homography(m, fine, REFINE_DELTA, &Hf);
+    free(m);
+    free_descriptor_set(&fa); free_descriptor_set(&fb);
+    *H = H0;
+    if(fine < MAX(4, o.min_inliers)) return coarse;
+    *H = Hf;
+    return fine;
+}
+
+// Draws the corners of ad and bd on a and b and saves their matches, inliers of H in green, to matches.png.
+static void save_matches(image a, image b, descriptor_set ad, descriptor_set bd, match* m, int n, hom3 H, float thresh)
+{
+    draw_corner_set(&a, ad);
+    draw_corner_set(&b, bd);
+    image matches_image = draw_inliers(a, b, H, m, n, thresh);
+    save_image_png(matches_image, "matches");
+    free_image(&matches_image);
+}
+
+image panorama_image(image a, image b, panorama_options o)
+{
+    if(o.coarse > 1) {
+        float sa, sb;
+        descriptor_set ca = detect_coarse(a, o, &sa), cb = detect_coarse(b, o, &sb);
+        hom3 H = hom3_translation(256, 0);
+        int inliers = register_coarse_to_fine(a, b, ca, cb, MAX(sa, sb), o, &H);
+        printf("found %d inliers\n", inliers);
+        if(o.draw_matches) {
+            // the fine matches stay inside the registration, show the coarse ones against the final H
+            int n;
+            match* m = match_panorama_descriptors(ca, cb, &n);
+            save_matches(a, b, ca, cb, m, n, H, o.inlier_thresh*MAX(sa, sb));
+            free(m);
+        }
+        free_descriptor_set(&ca); free_descriptor_set(&cb);
+        return combine_images(a, b, H, o.blend, o.bands);
+    }
+    int num_matches=0;
+    descriptor_set ad = detect_keypoints(a, o);
+    descriptor_set bd = detect_keypoints(b, o);
+    match* m = match_panorama_descriptors(ad, bd, &num_matches);
+
+    hom3 H = hom3_translation(256, 0);
+    int inliers = ransac_homography(m, num_matches, panorama_ransac_options(o), &H);
+    printf("found %d inliers\n", inliers);
+
+    if(o.draw_matches) save_matches(a, b, ad, bd, m, num_matches, H, o.inlier_thresh);
+    free_descriptor_set(&ad); free_descriptor_set(&bd); free(m);
+
+    return combine_images(a, b, H, o.blend, o.bands);
+}
+
+image panorama_image_params(image a, image b, float sigma, float thresh, int nms, float inlier_thresh, int iters, int cutoff, int draw_matches)
+{
+    panorama_options o = default_panorama_options();
+    o.sigma = sigma, o.thresh = thresh, o.nms = nms;
+    o.inlier_thresh = inlier_thresh;
+    o.iters = iters, o.cutoff = cutoff;
+    o.draw_matches = draw_matches;
+    return panorama_image(a, b, o);
 }
 
 // Draw the matches with inliers in green between two images.
-image draw_inliers(image a, image b, matrix H, match* m, int n, float thresh)
+image draw_inliers(image a, image b, hom3 H, match* m, int n, float thresh)
 {
     int inliers = model_inliers(H, m, n, thresh);
     image lines_image = draw_matches(a, b, m, n, inliers);
     return lines_image;
 }
+
+// A registration between two images of panorama_images: H maps points of image i to image j.
+typedef struct {
+    int i, j;
+    int inliers;
+    hom3 H;
+} image_pair;
+
+// The descriptors of every image, coarse ones with their scale if o.coarse > 1.
+static void register_pair(const image* im, const descriptor_set* d, const float* scale, panorama_options o, image_pair* p)
+{
+    if(o.coarse > 1) {
+        float s = MAX(scale[p->i], scale[p->j]);
+        p->inliers = register_coarse_to_fine(im[p->i], im[p->j], d[p->i], d[p->j], s, o, &p->H);
+    }
+    else {
+        int n;
+        match* m = match_panorama_descriptors(d[p->i], d[p->j], &n);
+        p->inliers = ransac_homography(m, n, panorama_ransac_options(o), &p->H);
+        free(m);
+    }
+    if(p->inliers < o.min_inliers) p->inliers = 0;
+}
+
+static void register_pairs(const image* im, const descriptor_set* d, const float* scale, panorama_options o, image_pair* p, int n)
+{
+    #pragma omp parallel for schedule(dynamic)
+    for(int k = 0; k < n; ++k) register_pair(im, d, scale, o, p + k);
+}
+
+// Grows a maximum spanning tree of the pairs by inliers from image ref, as in Prim's algorithm,
+// setting T[k] to the homography from image k to image ref. Returns the images reached in reached.
+static void chain_homographies(const image_pair* p, int np, int n, int ref, hom3* T, int* reached)
+{
+    for(int k = 0; k < n; ++k) reached[k] = 0;
+    reached[ref] = 1;
+    T[ref] = hom3_identity();
+    for(;;) {
+        int best = -1;
+        for(int k = 0; k < np; ++k) {
+            if(p[k].inliers <= 0 || reached[p[k].i] == reached[p[k].j]) continue;
+            if(best < 0 || p[k].inliers > p[best].inliers) best = k;
+        }
+        if(best < 0) break;
+        const image_pair* e = p + best;
+        hom3 Hinv;
+        if(reached[e->i]) {
+            if(!hom3_invert(e->H, &Hinv)) break;
+            T[e->j] = hom3_multiply(T[e->i], Hinv);
+            reached[e->j] = 1;
+        }
+        else {
+            T[e->i] = hom3_multiply(T[e->j], e->H);
+            reached[e->i] = 1;
+        }
+    }
+}
+
+// Bounding box of image m warped by T, 0 if a corner goes behind the camera.
+static int warped_bounds(image m, hom3 T, point* lo, point* hi)
+{
+    point corner[4] = { {0, 0}, {m.w, 0}, {0, m.h}, {m.w, m.h} };
+    for(int i = 0; i < 4; ++i) {
+        if(T.h[2][0]*corner[i].x + T.h[2][1]*corner[i].y + T.h[2][2] <= 0) return 0;
+        point q = hom3_project(T, corner[i]);
+        if(i == 0) *lo = *hi = q;
+        lo->x = fminf(lo->x, q.x), lo->y = fminf(lo->y, q.y);
+        hi->x = fmaxf(hi->x, q.x), hi->y = fmaxf(hi->y, q.y);
+    }
+    return (hi->x - lo->x)*(hi->y - lo->y) <= MAX_WARP_GROWTH*m.w*m.h;
+}
+
+static int bounds_overlap(point alo, point ahi, point blo, point bhi)
+{
+    return alo.x < bhi.x && blo.x < ahi.x && alo.y < bhi.y && blo.y < ahi.y;
+}
+
+// Registers the images and places them on one canvas in the coordinates of the middle image.
+// W[k] maps canvas pixels to pixels of image k, roi[k] bounds image k on the canvas and is empty
+// for images left out. Returns the size of the canvas.
+static rect plan_panorama(image* m, int n, panorama_options o, hom3* W, rect* roi)
+{
+    descriptor_set* d = calloc(n, sizeof(descriptor_set));
+    float* scale = calloc(n, sizeof(float));
+    #pragma omp parallel for schedule(dynamic)
+    for(int k = 0; k < n; ++k) d[k] = o.coarse > 1 ? detect_coarse(m[k], o, scale + k) : detect_keypoints(m[k], o);
+
+    // sequential pairs first, then the overlapping pairs up to neighbors apart
+    image_pair* pairs = NULL;
+    int np = 0;
+    for(int k = 0; k + 1 < n; ++k) {
+        image_pair p = { k, k + 1, 0, hom3_identity() };
+        sb_push(pairs, p);
+    }
+    np = sb_count(pairs);
+    register_pairs(m, d, scale, o, pairs, np);
+
+    const int ref = n / 2;
+    hom3* T = calloc(n, sizeof(hom3));
+    int* reached = calloc(n, sizeof(int));
+    point* lo = calloc(n, sizeof(point));
+    point* hi = calloc(n, sizeof(point));
+    if(o.neighbors > 1) {
+        chain_homographies(pairs, np, n, ref, T, reached);
+        for(int k = 0; k < n; ++k) reached[k] = reached[k] && warped_bounds(m[k], T[k], lo + k, hi + k);
+        for(int i = 0; i < n; ++i) {
+            for(int j = i + 2; j < n && j - i <= o.neighbors; ++j) {
+                if(reached[i] && reached[j] && !bounds_overlap(lo[i], hi[i], lo[j], hi[j])) continue;
+                image_pair p = { i, j, 0, hom3_identity() };
+                sb_push(pairs, p);
+            }
+        }
+        register_pairs(m, d, scale, o, pairs + np, sb_count(pairs) - np);
+        np = sb_count(pairs);
+    }
+    if(o.draw_matches) {
+        for(int k = 0; k < np; ++k) printf("images %d and %d: %d inliers\n", pairs[k].i, pairs[k].j, pairs[k].inliers);
+    }
+    chain_homographies(pairs, np, n, ref, T, reached);
+
+    // the canvas covers every reached image in the coordinates of the reference
+    point clo = {0, 0}, chi = {m[ref].w, m[ref].h};
+    for(int k = 0; k < n; ++k) {
+        if(reached[k]) reached[k] = warped_bounds(m[k], T[k], lo + k, hi + k);
+        if(!reached[k]) {
+            fprintf(stderr, "image %d could not be registered, leaving it out\n", k);
+            continue;
+        }
+        clo.x = fminf(clo.x, lo[k].x), clo.y = fminf(clo.y, lo[k].y);
+        chi.x = fmaxf(chi.x, hi[k].x), chi.y = fmaxf(chi.y, hi[k].y);
+    }
+    int x0 = floorf(clo.x), y0 = floorf(clo.y);
+    rect size = { 0, 0, (int)ceilf(chi.x) - x0, (int)ceilf(chi.y) - y0 };
+    for(int k = 0; k < n; ++k) {
+        hom3 Tinv;
+        rect none = {0};
+        roi[k] = none;
+        if(!reached[k] || !hom3_invert(T[k], &Tinv)) continue;
+        W[k] = hom3_multiply(Tinv, hom3_translation(x0, y0));
+        roi[k].x = (int)floorf(lo[k].x) - x0, roi[k].y = (int)floorf(lo[k].y) - y0;
+        roi[k].w = (int)ceilf(hi[k].x) - x0 - roi[k].x, roi[k].h = (int)ceilf(hi[k].y) - y0 - roi[k].y;
+    }
+
+    for(int k = 0; k < n; ++k) free_descriptor_set(&d[k]);
+    free(d); free(scale); sb_free(pairs);
+    free(T); free(reached); free(lo); free(hi);
+    return size;
+}
+
+image panorama_images(image* m, int n, panorama_options o)
+{
+    image empty = {0};
+    if(n <= 0) return empty;
+    hom3* W = calloc(n, sizeof(hom3));
+    rect* roi = calloc(n, sizeof(rect));
+    rect size = plan_panorama(m, n, o, W, roi);
+    image out = make_image(size.w, size.h, m[n/2].c);
+    image weight = o.blend != BLEND_NONE ? make_image(size.w, size.h, 1) : make_empty_image(0, 0, 0);
+    for(int k = 0; k < n; ++k) {
+        if(roi[k].w > 0 && roi[k].h > 0) blend_warp(m[k], W[k], out, weight, roi[k], o.blend, o.bands);
+    }
+    free_image(&weight);
+    free(W); free(roi);
+    return out;
+}
+
+canvas panorama_canvas(image* m, int n, panorama_options o, size_t memory)
+{
+    canvas empty = {0};
+    if(n <= 0) return empty;
+    hom3* W = calloc(n, sizeof(hom3));
+    rect* roi = calloc(n, sizeof(rect));
+    rect size = plan_panorama(m, n, o, W, roi);
+    // the weights take one channel of the memory, the pixels the others
+    const int c = m[n/2].c;
+    canvas cv = make_canvas(size.w, size.h, c, memory / (c + 1) * c);
+    canvas weight = make_canvas(size.w, size.h, 1, memory / (c + 1));
+    for(int k = 0; k < n; ++k) {
+        if(roi[k].w > 0 && roi[k].h > 0) blend_warp_canvas(m[k], W[k], &cv, &weight, roi[k], o.blend, o.bands);
+    }
+    free_canvas(&weight);
+    free(W); free(roi);
+    return cv;
+}
@@ -0,0 +1,143 @@
+#include "pyramid.h"
+
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define PYRAMID_MIN_SIZE 16
+#define PYRAMID_MAX_RADIUS 8
+
+static int next_size(int size, float scale)
+{
+    return (int)(size / scale + .5f);
+}
+
+// Blurs src with a gaussian matched to the scale step and resamples it to the size of dst.
+// The horizontal pass covers all of src, the vertical pass only the two source rows under every output row.
+static void downsample_level(image src, image* dst, image tmp, float scale)
+{
+    float sigma = .5f*sqrtf(scale*scale - 1.f);
+    int r = clamp((int)ceilf(3*sigma), 1, PYRAMID_MAX_RADIUS);
+    float kernel[2*PYRAMID_MAX_RADIUS + 1], sum = 0;
+    for(int j = -r; j <= r; ++j) sum += kernel[j + r] = expf(-j*j / (2*sigma*sigma));
+    for(int j = 0; j <= 2*r; ++j) kernel[j] /= sum;
+
+    const int w = src.w, h = src.h;
+    #pragma omp parallel for
+    for(int i = 0; i < src.c*h; ++i) {
+        const float* in = src.data + (size_t)i*w;
+        float* out = tmp.data + (size_t)i*w;
+        for(int x = 0; x < w; ++x) {
+            float v = 0;
+            if(x >= r && x + r < w) {
+                for(int j = -r; j <= r; ++j) v += kernel[j + r]*in[x + j];
+            }
+            else {
+                for(int j = -r; j <= r; ++j) v += kernel[j + r]*in[clamp(x + j, 0, w - 1)];
+            }
+            out[x] = v;
+        }
+    }
+
+    // source columns and weights of every output column, pixel centers aligned
+    const float sx = (float)w / dst->w, sy = (float)h / dst->h;
+    int* xi = malloc(dst->w*sizeof(int));
+    float* xw = malloc(dst->w*sizeof(float));
+    for(int x = 0; x < dst->w; ++x) {
+        float fx = fminf(fmaxf((x + .5f)*sx - .5f, 0), w - 1);
+        xi[x] = MIN((int)fx, w - 2);
+        xw[x] = fx - xi[x];
+    }
+    #pragma omp parallel
+    {
+        float* rows = malloc(2*w*sizeof(float));
+        #pragma omp for
+        for(int i = 0; i < dst->c*dst->h; ++i) {
+            int c = i / dst->h, y = i % dst->h;
+            float fy = fminf(fmaxf((y + .5f)*sy - .5f, 0), h - 1);
+            int y0 = (int)fy;
+            float wy = fy - y0;
+            const float* plane = tmp.data + (size_t)c*w*h;
+            for(int k = 0; k < 2; ++k) {
+                int yk = MIN(y0 + k, h - 1);
+                float* row = rows + k*w;
+                for(int x = 0; x < w; ++x) row[x] = 0;
+                for(int j = -r; j <= r; ++j) {
+                    const float* in = plane + (size_t)clamp(yk + j, 0, h - 1)*w;
+                    float kj = kernel[j + r];
+                    for(int x = 0; x < w; ++x) row[x] += kj*in[x];
+                }
+            }
+            float* out = dst->data + (size_t)i*dst->w;
+            for(int x = 0; x < dst->w; ++x) {
+                int x0 = xi[x], x1 = MIN(x0 + 1, w - 1);
+                float top = rows[x0] + xw[x]*(rows[x1] - rows[x0]);
+                float bot = rows[w + x0] + xw[x]*(rows[w + x1] - rows[w + x0]);
+                out[x] = top + wy*(bot - top);
+            }
+        }
+        free(rows);
+    }
+    free(xi); free(xw);
+}
+
+image_pyramid make_image_pyramid(image m, int levels, float scale)
+{
+    image_pyramid p = {0};
+    p.scale = scale > 1.f ? scale : 2.f;
+    p.level = calloc(levels > 1 ? levels : 1, sizeof(image));
+    p.level[0] = make_image(m.w, m.h, m.c);
+    p.levels = 1;
+    int w = m.w, h = m.h;
+    while(p.levels < levels) {
+        w = next_size(w, p.scale), h = next_size(h, p.scale);
+        if(w < PYRAMID_MIN_SIZE || h < PYRAMID_MIN_SIZE) break;
+        p.level[p.levels++] = make_image(w, h, m.c);
+    }
+    p.scratch = make_image(m.w, m.h, m.c);
+    update_image_pyramid(&p, m);
+    return p;
+}
+
+void update_image_pyramid(image_pyramid* p, image m)
+{
+    image base = p->level[0];
+    if(base.w != m.w || base.h != m.h || base.c != m.c) {
+        int levels = p->levels;
+        float scale = p->scale;
+        free_image_pyramid(p);
+        *p = make_image_pyramid(m, levels, scale);
+        return;
+    }
+    memcpy(base.data, m.data, (size_t)m.w*m.h*m.c*sizeof(float));
+    for(int i = 1; i < p->levels; ++i) {
+        image src = p->level[i-1], tmp = p->scratch;
+        tmp.w = src.w, tmp.h = src.h;
+        downsample_level(src, &p->level[i], tmp, p->scale);
+    }
+}
+
+void free_image_pyramid(image_pyramid* p)
+{
+    for(int i = 0; i < p->levels; ++i) free_image(&p->level[i]);
+    free(p->level);
+    free_image(&p->scratch);
+    p->level = NULL;
+    p->levels = 0;
+}
+
+point pyramid_to_base(image_pyramid p, int level, point q)
+{
+    float rx = (float)p.level[0].w / p.level[level].w, ry = (float)p.level[0].h / p.level[level].h;
+    point b = { (q.x + .5f)*rx - .5f, (q.y + .5f)*ry - .5f };
+    return b;
+}
+
+point base_to_pyramid(image_pyramid p, int level, point q)
+{
+    float rx = (float)p.level[level].w / p.level[0].w, ry = (float)p.level[level].h / p.level[0].h;
+    point l = { (q.x + .5f)*rx - .5f, (q.y + .5f)*ry - .5f };
+    return l;
+}
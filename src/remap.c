@@ -0,0 +1,200 @@
+#include "remap.h"
+
+#include "utils.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#define REMAP_OUTSIDE (REMAP_STEPS*REMAP_STEPS)
+#define REMAP_CHUNK 256 // pixels of a row whose weights are expanded at once
+#define REMAP_CACHE_SIZE 8
+#define REMAP_MAX_SOURCE 32767 // largest source side the int16 coordinates hold
+
+// bilinear weights of every fraction, and zeros for pixels outside the source
+static float remap_weights[REMAP_OUTSIDE + 1][4];
+static int remap_weights_ready;
+
+static void init_remap_weights(void)
+{
+    #pragma omp critical(remap_weights)
+    if(!remap_weights_ready) {
+        for(int fy = 0; fy < REMAP_STEPS; ++fy) {
+            for(int fx = 0; fx < REMAP_STEPS; ++fx) {
+                float x = (float)fx / REMAP_STEPS, y = (float)fy / REMAP_STEPS;
+                float* w = remap_weights[fy*REMAP_STEPS + fx];
+                w[0] = (1 - x)*(1 - y), w[1] = x*(1 - y), w[2] = (1 - x)*y, w[3] = x*y;
+            }
+        }
+        remap_weights_ready = 1;
+    }
+}
+
+remap_map make_remap_map(int w, int h, int src_w, int src_h)
+{
+    remap_map m = {0};
+    m.w = w, m.h = h;
+    m.src_w = src_w, m.src_h = src_h;
+    if(src_w > REMAP_MAX_SOURCE || src_h > REMAP_MAX_SOURCE) {
+        fprintf(stderr, "remap: source %dx%d is larger than %d pixels a side\n", src_w, src_h, REMAP_MAX_SOURCE);
+        return m;
+    }
+    m.xy = calloc(2*(size_t)w*h, sizeof(short));
+    m.frac = malloc((size_t)w*h*sizeof(unsigned short));
+    for(size_t i = 0; i < (size_t)w*h; ++i) m.frac[i] = REMAP_OUTSIDE;
+    return m;
+}
+
+void free_remap_map(remap_map* m)
+{
+    free(m->xy);
+    free(m->frac);
+    m->xy = NULL;
+    m->frac = NULL;
+}
+
+void set_remap_point(remap_map* m, int x, int y, float sx, float sy)
+{
+    size_t i = (size_t)y*m->w + x;
+    if(!(sx >= 0 && sx <= m->src_w - 1 && sy >= 0 && sy <= m->src_h - 1)) {
+        m->xy[2*i] = m->xy[2*i+1] = 0;
+        m->frac[i] = REMAP_OUTSIDE;
+        return;
+    }
+    int fx = lrintf(sx*REMAP_STEPS), fy = lrintf(sy*REMAP_STEPS);
+    int x0 = fx >> REMAP_BITS, y0 = fy >> REMAP_BITS;
+    fx &= REMAP_STEPS - 1, fy &= REMAP_STEPS - 1;
+    // keep the footprint inside on the last row and column, with most of the weight on it
+    if(x0 >= m->src_w - 1 && m->src_w > 1) x0 = m->src_w - 2, fx = REMAP_STEPS - 1;
+    if(y0 >= m->src_h - 1 && m->src_h > 1) y0 = m->src_h - 2, fy = REMAP_STEPS - 1;
+    m->xy[2*i] = x0, m->xy[2*i+1] = y0;
+    m->frac[i] = fy*REMAP_STEPS + fx;
+}
+
+image remap(image src, const remap_map* m)
+{
+    if(!m->xy || src.w != m->src_w || src.h != m->src_h) {
+        fprintf(stderr, "remap: map for %dx%d images applied to a %dx%d image\n", m->src_w, m->src_h, src.w, src.h);
+        return make_empty_image(0, 0, 0);
+    }
+    init_remap_weights();
+    image out = make_image(m->w, m->h, src.c);
+    const int w = src.w, plane = src.w*src.h;
+    // a 1 pixel source has no footprint to its right or below
+    const int dx = src.w > 1, dy = src.h > 1 ? src.w : 0;
+    #pragma omp parallel for schedule(dynamic)
+    for(int y = 0; y < m->h; ++y) {
+        int idx[REMAP_CHUNK];
+        float w00[REMAP_CHUNK], w10[REMAP_CHUNK], w01[REMAP_CHUNK], w11[REMAP_CHUNK];
+        for(int x0 = 0; x0 < m->w; x0 += REMAP_CHUNK) {
+            int n = MIN(REMAP_CHUNK, m->w - x0);
+            const short* xy = m->xy + 2*((size_t)y*m->w + x0);
+            const unsigned short* frac = m->frac + (size_t)y*m->w + x0;
+            for(int i = 0; i < n; ++i) {
+                const float* wt = remap_weights[frac[i]];
+                idx[i] = xy[2*i+1]*w + xy[2*i];
+                w00[i] = wt[0], w10[i] = wt[1], w01[i] = wt[2], w11[i] = wt[3];
+            }
+            for(int c = 0; c < src.c; ++c) {
+                const float* p = src.data + (size_t)c*plane;
+                float* o = out.data + (size_t)c*m->w*m->h + (size_t)y*m->w + x0;
+                #pragma omp simd
+                for(int i = 0; i < n; ++i) {
+                    const float* q = p + idx[i];
+                    o[i] = w00[i]*q[0] + w10[i]*q[dx] + w01[i]*q[dy] + w11[i]*q[dy + dx];
+                }
+            }
+        }
+    }
+    return out;
+}
+
+// map comes first, so that release_remap_map can find the entry of a map it handed out
+typedef struct {
+    remap_map map;
+    int w, h;
+    float f;
+    int pins;
+    unsigned long last_use;
+} remap_cache_entry;
+
+static remap_cache_entry remap_cache[REMAP_CACHE_SIZE];
+static unsigned long remap_clock;
+
+static remap_map build_cylindrical_map(int w, int h, float f)
+{
+    int xc = w / 2, yc = h / 2;
+    int ow = 2*f*atan2f(xc, f);
+    remap_map m = make_remap_map(ow, h, w, h);
+    if(!m.xy) return m;
+    // theta only depends on the column: X/Z = tan(theta), and Y/Z = (y - yc)/(f cos(theta))
+    float* mx = malloc(ow*sizeof(float));
+    float* inv_cos = malloc(ow*sizeof(float));
+    for(int x = 0; x < ow; ++x) {
+        float theta = (x - ow/2) / f;
+        mx[x] = f*tanf(theta) + xc;
+        inv_cos[x] = 1.f / cosf(theta);
+    }
+    #pragma omp parallel for
+    for(int y = 0; y < h; ++y) {
+        for(int x = 0; x < ow; ++x) {
+            set_remap_point(&m, x, y, mx[x], (y - yc)*inv_cos[x] + yc);
+        }
+    }
+    free(mx); free(inv_cos);
+    return m;
+}
+
+const remap_map* cylindrical_remap_map(int w, int h, float f)
+{
+    remap_cache_entry* e = NULL;
+    #pragma omp critical(remap_cache)
+    {
+        for(int i = 0; i < REMAP_CACHE_SIZE && !e; ++i) {
+            remap_cache_entry* c = remap_cache + i;
+            if(c->map.xy && c->w == w && c->h == h && c->f == f) e = c;
+        }
+        if(!e) {
+            // the empty or least recently used entry that nobody holds
+            for(int i = 0; i < REMAP_CACHE_SIZE; ++i) {
+                remap_cache_entry* c = remap_cache + i;
+                if(c->pins) continue;
+                if(!c->map.xy) {
+                    e = c;
+                    break;
+                }
+                if(!e || c->last_use < e->last_use) e = c;
+            }
+            // every entry is in use, the map lives outside the cache until it is released
+            if(!e) e = calloc(1, sizeof(remap_cache_entry));
+            if(e->map.xy) free_remap_map(&e->map);
+            e->w = w, e->h = h, e->f = f;
+            e->map = build_cylindrical_map(w, h, f);
+        }
+        e->pins++;
+        e->last_use = ++remap_clock;
+    }
+    return &e->map;
+}
+
+void release_remap_map(const remap_map* m)
+{
+    remap_cache_entry* e = (remap_cache_entry*)m;
+    #pragma omp critical(remap_cache)
+    {
+        if(e >= remap_cache && e < remap_cache + REMAP_CACHE_SIZE) e->pins--;
+        else {
+            free_remap_map(&e->map);
+            free(e);
+        }
+    }
+}
+
+void clear_remap_cache(void)
+{
+    #pragma omp critical(remap_cache)
+    for(int i = 0; i < REMAP_CACHE_SIZE; ++i) {
+        if(remap_cache[i].map.xy && !remap_cache[i].pins) free_remap_map(&remap_cache[i].map);
+    }
+}
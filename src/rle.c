@@ -0,0 +1,214 @@
+#include "rle.h"
+
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// builds an rle_image from a scratch buffer where row y holds count[y] runs starting at runs[offset[y]]
+static rle_image pack_rows(int w, int h, run* runs, int* offset, int* count)
+{
+    rle_image r;
+    r.w = w, r.h = h;
+    r.row_start = malloc((h + 1)*sizeof(int));
+    r.row_start[0] = 0;
+    for(int y = 0; y < h; ++y) r.row_start[y + 1] = r.row_start[y] + count[y];
+    r.n = r.row_start[h];
+    r.runs = malloc((r.n ? r.n : 1)*sizeof(run));
+    #pragma omp parallel for
+    for(int y = 0; y < h; ++y) {
+        memcpy(r.runs + r.row_start[y], runs + offset[y], count[y]*sizeof(run));
+    }
+    return r;
+}
+
+rle_image make_rle_image(image m, float thresh)
+{
+    int* count = calloc(m.h, sizeof(int));
+    int* offset = malloc((m.h + 1)*sizeof(int));
+    // count the runs of every row, then encode them at their final position
+    #pragma omp parallel for
+    for(int y = 0; y < m.h; ++y) {
+        const float* row = m.data + y*m.w;
+        int prev = 0;
+        for(int x = 0; x < m.w; ++x) {
+            int fg = row[x] > thresh;
+            count[y] += fg && !prev;
+            prev = fg;
+        }
+    }
+    offset[0] = 0;
+    for(int y = 0; y < m.h; ++y) offset[y + 1] = offset[y] + count[y];
+
+    rle_image r;
+    r.w = m.w, r.h = m.h, r.n = offset[m.h];
+    r.row_start = offset;
+    r.runs = malloc((r.n ? r.n : 1)*sizeof(run));
+    #pragma omp parallel for
+    for(int y = 0; y < m.h; ++y) {
+        const float* row = m.data + y*m.w;
+        run* out = r.runs + offset[y];
+        for(int x = 0; x < m.w; ++x) {
+            if(row[x] <= thresh) continue;
+            int xs = x;
+            while(x < m.w && row[x] > thresh) ++x;
+            out->xs = xs, out->xe = x;
+            ++out;
+        }
+    }
+    free(count);
+    return r;
+}
+
+image rle_to_image(rle_image r)
+{
+    image m = make_image(r.w, r.h, 1);
+    #pragma omp parallel for
+    for(int y = 0; y < r.h; ++y) {
+        float* row = m.data + y*r.w;
+        for(int i = r.row_start[y]; i < r.row_start[y + 1]; ++i) {
+            for(int x = r.runs[i].xs; x < r.runs[i].xe; ++x) row[x] = 1.f;
+        }
+    }
+    return m;
+}
+
+rle_image copy_rle_image(rle_image r)
+{
+    rle_image c = r;
+    c.row_start = malloc((r.h + 1)*sizeof(int));
+    c.runs = malloc((r.n ? r.n : 1)*sizeof(run));
+    memcpy(c.row_start, r.row_start, (r.h + 1)*sizeof(int));
+    memcpy(c.runs, r.runs, r.n*sizeof(run));
+    return c;
+}
+
+void free_rle_image(rle_image* r)
+{
+    if(r->runs) free(r->runs);
+    if(r->row_start) free(r->row_start);
+    r->runs = NULL, r->row_start = NULL;
+    r->n = 0;
+}
+
+int rle_count_pixels(rle_image r)
+{
+    int count = 0;
+    #pragma omp parallel for reduction(+:count)
+    for(int i = 0; i < r.n; ++i) {
+        count += r.runs[i].xe - r.runs[i].xs;
+    }
+    return count;
+}
+
+// appends a run to out, merging it with the last run if they touch. runs must come sorted by xs.
+static inline void push_union(run* out, int* n, run a)
+{
+    if(*n > 0 && a.xs <= out[*n - 1].xe) {
+        out[*n - 1].xe = MAX(out[*n - 1].xe, a.xe);
+        return;
+    }
+    out[(*n)++] = a;
+}
+
+// union of the row y widened by one pixel with rows y-1 and y+1
+static inline int dilate_row(rle_image r, int y, run* out)
+{
+    const run* rows[3];
+    int len[3], widen[3], pos[3] = {0}, num_rows = 0, n = 0;
+    for(int dy = -1; dy <= 1; ++dy) {
+        if(y + dy < 0 || y + dy >= r.h) continue;
+        rows[num_rows] = r.runs + r.row_start[y + dy];
+        len[num_rows] = r.row_start[y + dy + 1] - r.row_start[y + dy];
+        widen[num_rows++] = dy == 0;
+    }
+    for(;;) {
+        // merge the three rows by taking the run that starts first
+        int best = -1, best_xs = 0;
+        for(int k = 0; k < num_rows; ++k) {
+            if(pos[k] >= len[k]) continue;
+            int xs = rows[k][pos[k]].xs - widen[k];
+            if(best < 0 || xs < best_xs) best = k, best_xs = xs;
+        }
+        if(best < 0) break;
+        run a = rows[best][pos[best]++];
+        if(widen[best]) {
+            a.xs = MAX(0, a.xs - 1);
+            a.xe = MIN(r.w, a.xe + 1);
+        }
+        push_union(out, &n, a);
+    }
+    return n;
+}
+
+// intersection of two sorted run lists
+static inline int intersect_runs(const run* a, int an, const run* b, int bn, run* out)
+{
+    int i = 0, j = 0, n = 0;
+    while(i < an && j < bn) {
+        int xs = MAX(a[i].xs, b[j].xs), xe = MIN(a[i].xe, b[j].xe);
+        if(xs < xe) {
+            out[n].xs = xs, out[n].xe = xe;
+            ++n;
+        }
+        if(a[i].xe < b[j].xe) ++i;
+        else ++j;
+    }
+    return n;
+}
+
+// intersection of the row y narrowed by one pixel with rows y-1 and y+1
+static inline int erode_row(rle_image r, int y, run* out, run* tmp)
+{
+    int n = 0;
+    for(int i = r.row_start[y]; i < r.row_start[y + 1]; ++i) {
+        run a = r.runs[i];
+        if(a.xs > 0) a.xs++;
+        if(a.xe < r.w) a.xe--;
+        if(a.xs < a.xe) out[n++] = a;
+    }
+    for(int dy = -1; dy <= 1; dy += 2) {
+        if(y + dy < 0 || y + dy >= r.h) continue;
+        const run* other = r.runs + r.row_start[y + dy];
+        int other_n = r.row_start[y + dy + 1] - r.row_start[y + dy];
+        n = intersect_runs(out, n, other, other_n, tmp);
+        memcpy(out, tmp, n*sizeof(run));
+    }
+    return n;
+}
+
+static rle_image rle_morph(rle_image r, int times, int dilate)
+{
+    rle_image cur = copy_rle_image(r);
+    while(times-- > 0) {
+        // a row of the result never has more runs than its three source rows together
+        int* offset = malloc((r.h + 1)*sizeof(int));
+        int* count = malloc(r.h*sizeof(int));
+        offset[0] = 0;
+        for(int y = 0; y < r.h; ++y) {
+            int y0 = MAX(0, y - 1), y1 = MIN(r.h, y + 2);
+            offset[y + 1] = offset[y] + cur.row_start[y1] - cur.row_start[y0];
+        }
+        run* scratch = malloc((2*offset[r.h] + 1)*sizeof(run));
+        #pragma omp parallel for schedule(dynamic, 16)
+        for(int y = 0; y < r.h; ++y) {
+            run* out = scratch + offset[y];
+            count[y] = dilate ? dilate_row(cur, y, out) : erode_row(cur, y, out, scratch + offset[r.h] + offset[y]);
+        }
+        rle_image next = pack_rows(r.w, r.h, scratch, offset, count);
+        free(scratch); free(offset); free(count);
+        free_rle_image(&cur);
+        cur = next;
+    }
+    return cur;
+}
+
+rle_image rle_dilate(rle_image r, int times)
+{
+    return rle_morph(r, times, 1);
+}
+
+rle_image rle_erode(rle_image r, int times)
+{
+    return rle_morph(r, times, 0);
+}
@@ -0,0 +1,174 @@
+#include "solve.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define JACOBI_SWEEPS 30
+#define JACOBI_EPS 1e-7
+
+int cholesky_solve(matrix A, matrix B)
+{
+    const int n = A.rows;
+    for(int j = 0; j < n; ++j) {
+        double d = A.data[j][j];
+        for(int k = 0; k < j; ++k) d -= (double)A.data[j][k]*A.data[j][k];
+        if(d <= 0) return 0;
+        float ljj = sqrt(d);
+        A.data[j][j] = ljj;
+        for(int i = j + 1; i < n; ++i) {
+            double v = A.data[i][j];
+            for(int k = 0; k < j; ++k) v -= (double)A.data[i][k]*A.data[j][k];
+            A.data[i][j] = v / ljj;
+        }
+    }
+    for(int c = 0; c < B.cols; ++c) {
+        // L y = b, then Lt x = y
+        for(int i = 0; i < n; ++i) {
+            double v = B.data[i][c];
+            for(int k = 0; k < i; ++k) v -= (double)A.data[i][k]*B.data[k][c];
+            B.data[i][c] = v / A.data[i][i];
+        }
+        for(int i = n - 1; i >= 0; --i) {
+            double v = B.data[i][c];
+            for(int k = i + 1; k < n; ++k) v -= (double)A.data[k][i]*B.data[k][c];
+            B.data[i][c] = v / A.data[i][i];
+        }
+    }
+    return 1;
+}
+
+void householder_qr(matrix A, float* tau)
+{
+    const int m = A.rows, n = A.cols;
+    for(int j = 0; j < n; ++j) {
+        double norm = 0;
+        for(int i = j; i < m; ++i) norm += (double)A.data[i][j]*A.data[i][j];
+        norm = sqrt(norm);
+        if(norm == 0) {
+            tau[j] = 0;
+            continue;
+        }
+        // v = x + sign(x0)|x| e0 scaled so that v0 = 1, H = I - tau v vt
+        double x0 = A.data[j][j];
+        double alpha = x0 >= 0 ? -norm : norm;
+        double v0 = x0 - alpha;
+        for(int i = j + 1; i < m; ++i) A.data[i][j] /= v0;
+        tau[j] = (alpha - x0) / alpha;
+        A.data[j][j] = alpha;
+        for(int c = j + 1; c < n; ++c) {
+            double d = A.data[j][c];
+            for(int i = j + 1; i < m; ++i) d += (double)A.data[i][j]*A.data[i][c];
+            d *= tau[j];
+            A.data[j][c] -= d;
+            for(int i = j + 1; i < m; ++i) A.data[i][c] -= d*A.data[i][j];
+        }
+    }
+}
+
+int qr_solve(matrix A, matrix B)
+{
+    const int m = A.rows, n = A.cols;
+    float* tau = malloc(n*sizeof(float));
+    householder_qr(A, tau);
+    // Qt b, reflector by reflector
+    for(int j = 0; j < n; ++j) {
+        for(int c = 0; c < B.cols; ++c) {
+            double d = B.data[j][c];
+            for(int i = j + 1; i < m; ++i) d += (double)A.data[i][j]*B.data[i][c];
+            d *= tau[j];
+            B.data[j][c] -= d;
+            for(int i = j + 1; i < m; ++i) B.data[i][c] -= d*A.data[i][j];
+        }
+    }
+    free(tau);
+    // R x = Qt b, singular if a diagonal entry is negligible next to the largest
+    float rmax = 0;
+    for(int j = 0; j < n; ++j) rmax = fmaxf(rmax, fabsf(A.data[j][j]));
+    for(int j = 0; j < n; ++j) {
+        if(!(fabsf(A.data[j][j]) > rmax*1e-6f)) return 0;
+    }
+    for(int c = 0; c < B.cols; ++c) {
+        for(int i = n - 1; i >= 0; --i) {
+            double v = B.data[i][c];
+            for(int k = i + 1; k < n; ++k) v -= (double)A.data[i][k]*B.data[k][c];
+            B.data[i][c] = v / A.data[i][i];
+        }
+    }
+    return 1;
+}
+
+void svd_jacobi(matrix A, float* s, matrix V)
+{
+    const int m = A.rows, n = A.cols;
+    for(int i = 0; i < n; ++i) {
+        memset(V.data[i], 0, n*sizeof(float));
+        V.data[i][i] = 1;
+    }
+    // rotate pairs of columns until all are orthogonal
+    for(int sweep = 0; sweep < JACOBI_SWEEPS; ++sweep) {
+        int rotated = 0;
+        for(int p = 0; p < n - 1; ++p) {
+            for(int q = p + 1; q < n; ++q) {
+                double alpha = 0, beta = 0, gamma = 0;
+                for(int i = 0; i < m; ++i) {
+                    double ap = A.data[i][p], aq = A.data[i][q];
+                    alpha += ap*ap, beta += aq*aq, gamma += ap*aq;
+                }
+                if(fabs(gamma) <= JACOBI_EPS*sqrt(alpha*beta)) continue;
+                rotated = 1;
+                double zeta = (beta - alpha) / (2*gamma);
+                double t = (zeta >= 0 ? 1 : -1) / (fabs(zeta) + sqrt(1 + zeta*zeta));
+                double c = 1 / sqrt(1 + t*t), sn = c*t;
+                for(int i = 0; i < m; ++i) {
+                    double ap = A.data[i][p], aq = A.data[i][q];
+                    A.data[i][p] = c*ap - sn*aq;
+                    A.data[i][q] = sn*ap + c*aq;
+                }
+                for(int i = 0; i < n; ++i) {
+                    double vp = V.data[i][p], vq = V.data[i][q];
+                    V.data[i][p] = c*vp - sn*vq;
+                    V.data[i][q] = sn*vp + c*vq;
+                }
+            }
+        }
+        if(!rotated) break;
+    }
+    for(int j = 0; j < n; ++j) {
+        double norm = 0;
+        for(int i = 0; i < m; ++i) norm += (double)A.data[i][j]*A.data[i][j];
+        s[j] = sqrt(norm);
+    }
+}
+
+float null_vector(matrix A, float* x)
+{
+    const int n = A.cols;
+    matrix R = A;
+    if(A.rows > n) {
+        // A = QR has the singular values and right singular vectors of R
+        float* tau = malloc(n*sizeof(float));
+        householder_qr(A, tau);
+        free(tau);
+        R = make_matrix(n, n);
+        for(int i = 0; i < n; ++i) {
+            for(int j = i; j < n; ++j) R.data[i][j] = A.data[i][j];
+        }
+    }
+    float* s = malloc(n*sizeof(float));
+    matrix V = make_matrix(n, n);
+    svd_jacobi(R, s, V);
+    int best = 0, next = -1;
+    for(int j = 1; j < n; ++j) if(s[j] < s[best]) best = j;
+    for(int j = 0; j < n; ++j) if(j != best && (next < 0 || s[j] < s[next])) next = j;
+    for(int i = 0; i < n; ++i) x[i] = V.data[i][best];
+    float largest = 0;
+    for(int j = 0; j < n; ++j) largest = fmaxf(largest, s[j]);
+    // a second singular value at rounding level means x is one of many null vectors
+    float ratio = 1;
+    if(next >= 0 && s[next] > JACOBI_EPS*largest) ratio = s[best] / s[next];
+    free(s);
+    free_matrix(&V);
+    if(R.data != A.data) free_matrix(&R);
+    return ratio;
+}
@@ -1,5 +1,8 @@
 #include "utils.h"
 
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <sys/time.h>
 
@@ -38,3 +41,25 @@ float min4f(float a, float b, float c, float d)
     return MIN(a, MIN(b, MIN(c, d)));
 }
 
+// fast pseudo random numbers, state must be nonzero.
+unsigned int xorshift32(unsigned int* state)
+{
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+void* aligned_calloc(size_t alignment, size_t bytes)
+{
+    // aligned_alloc wants the size to be a multiple of the alignment
+    size_t size = bytes ? (bytes + alignment - 1) & ~(alignment - 1) : alignment;
+    void* data = aligned_alloc(alignment, size);
+    if(!data) {
+        fprintf(stderr, "failed to allocate %zu bytes\n", size);
+        return NULL;
+    }
+    memset(data, 0, size);
+    return data;
+}
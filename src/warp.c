@@ -0,0 +1,140 @@
+#include "warp.h"
+
+#include "utils.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+#define WARP_TILE 64
+
+rect image_rect(image m)
+{
+    rect r = { 0, 0, m.w, m.h };
+    return r;
+}
+
+rect intersect_rect(rect a, rect b)
+{
+    int x0 = MAX(a.x, b.x), y0 = MAX(a.y, b.y);
+    int x1 = MIN(a.x + a.w, b.x + b.w), y1 = MIN(a.y + a.h, b.y + b.h);
+    rect r = { x0, y0, MAX(0, x1 - x0), MAX(0, y1 - y0) };
+    return r;
+}
+
+// The outline of src in destination coordinates, as the lines of its 4 edges.
+// A tile is outside if all its corners are outside one edge. Only valid if no corner of src
+// maps behind the camera, otherwise every tile is kept.
+typedef struct {
+    int valid;
+    float a[4], b[4], c[4]; // inside if a*x + b*y + c >= 0
+    rect bounds;
+} outline;
+
+static outline make_outline(image src, hom3 H)
+{
+    outline o = {0};
+    hom3 Hinv;
+    if(!hom3_invert(H, &Hinv)) return o;
+    point corner[4] = { {0, 0}, {src.w, 0}, {src.w, src.h}, {0, src.h} };
+    point q[4];
+    for(int i = 0; i < 4; ++i) {
+        float w = Hinv.h[2][0]*corner[i].x + Hinv.h[2][1]*corner[i].y + Hinv.h[2][2];
+        if(w <= 0) return o;
+        q[i] = hom3_project(Hinv, corner[i]);
+    }
+    // orient the edges so that the inside is on the positive side
+    float area = 0;
+    for(int i = 0; i < 4; ++i) {
+        point p = q[i], n = q[(i + 1) % 4];
+        area += p.x*n.y - n.x*p.y;
+    }
+    float sign = area >= 0 ? 1 : -1;
+    float minx = q[0].x, maxx = q[0].x, miny = q[0].y, maxy = q[0].y;
+    for(int i = 0; i < 4; ++i) {
+        point p = q[i], n = q[(i + 1) % 4];
+        o.a[i] = -sign*(n.y - p.y);
+        o.b[i] = sign*(n.x - p.x);
+        o.c[i] = -(o.a[i]*p.x + o.b[i]*p.y);
+        minx = fminf(minx, p.x), maxx = fmaxf(maxx, p.x);
+        miny = fminf(miny, p.y), maxy = fmaxf(maxy, p.y);
+    }
+    rect r = { (int)floorf(minx) - 1, (int)floorf(miny) - 1, 0, 0 };
+    r.w = (int)ceilf(maxx) + 2 - r.x, r.h = (int)ceilf(maxy) + 2 - r.y;
+    o.bounds = r;
+    o.valid = 1;
+    return o;
+}
+
+static int tile_outside(const outline* o, rect t)
+{
+    // one pixel of margin for the bilinear footprint
+    float x0 = t.x - 1, y0 = t.y - 1, x1 = t.x + t.w + 1, y1 = t.y + t.h + 1;
+    for(int i = 0; i < 4; ++i) {
+        float a = o->a[i], b = o->b[i], c = o->c[i];
+        if(a*x0 + b*y0 + c < 0 && a*x1 + b*y0 + c < 0 && a*x0 + b*y1 + c < 0 && a*x1 + b*y1 + c < 0) return 1;
+    }
+    return 0;
+}
+
+static void warp_tile(image src, hom3 H, image dst, rect t)
+{
+    const float h00 = H.h[0][0], h10 = H.h[1][0], h20 = H.h[2][0];
+    const int plane = src.w*src.h, dplane = dst.w*dst.h;
+    for(int y = t.y; y < t.y + t.h; ++y) {
+        // homogeneous source coordinates of the first pixel, then one step of the first column of H per pixel
+        float X0 = h00*t.x + H.h[0][1]*y + H.h[0][2];
+        float Y0 = h10*t.x + H.h[1][1]*y + H.h[1][2];
+        float W0 = h20*t.x + H.h[2][1]*y + H.h[2][2];
+        float* out = dst.data + (size_t)y*dst.w;
+        for(int i = 0; i < t.w; ++i) {
+            float w = W0 + i*h20;
+            float sx = (X0 + i*h00) / w, sy = (Y0 + i*h10) / w;
+            if(!(sx >= 0 && sx < src.w && sy >= 0 && sy < src.h)) continue;
+            int x0 = (int)sx, y0 = (int)sy;
+            float fx = sx - x0, fy = sy - y0;
+            int x1 = MIN(x0 + 1, src.w - 1), y1 = MIN(y0 + 1, src.h - 1);
+            float w00 = (1 - fx)*(1 - fy), w10 = fx*(1 - fy), w01 = (1 - fx)*fy, w11 = fx*fy;
+            const float* r0 = src.data + (size_t)y0*src.w;
+            const float* r1 = src.data + (size_t)y1*src.w;
+            for(int k = 0; k < dst.c; ++k) {
+                int kc = MIN(k, src.c - 1);
+                const float* a = r0 + (size_t)kc*plane;
+                const float* b = r1 + (size_t)kc*plane;
+                out[(size_t)k*dplane + t.x + i] = w00*a[x0] + w10*a[x1] + w01*b[x0] + w11*b[x1];
+            }
+        }
+    }
+}
+
+int warp_reaches(image src, hom3 H, rect r)
+{
+    outline o = make_outline(src, H);
+    if(!o.valid) return 1;
+    rect in = intersect_rect(r, o.bounds);
+    return in.w > 0 && in.h > 0 && !tile_outside(&o, r);
+}
+
+void warp_perspective(image src, hom3 H, image dst, rect roi)
+{
+    roi = intersect_rect(roi, image_rect(dst));
+    outline o = make_outline(src, H);
+    if(o.valid) roi = intersect_rect(roi, o.bounds);
+    if(roi.w <= 0 || roi.h <= 0) return;
+
+    int cols = (roi.w + WARP_TILE - 1) / WARP_TILE, rows = (roi.h + WARP_TILE - 1) / WARP_TILE;
+    rect* tiles = malloc((size_t)cols*rows*sizeof(rect));
+    int n = 0;
+    for(int ty = 0; ty < rows; ++ty) {
+        for(int tx = 0; tx < cols; ++tx) {
+            rect t = { roi.x + tx*WARP_TILE, roi.y + ty*WARP_TILE, WARP_TILE, WARP_TILE };
+            t = intersect_rect(t, roi);
+            if(o.valid && tile_outside(&o, t)) continue;
+            tiles[n++] = t;
+        }
+    }
+    #pragma omp parallel for schedule(dynamic)
+    for(int i = 0; i < n; ++i) {
+        warp_tile(src, H, dst, tiles[i]);
+    }
+    free(tiles);
+}